@@ -0,0 +1,199 @@
+// Fair-share scheduling, in a kernel built with make SCHED=cfs
+// in place of proc.c's multi-level feedback queues.
+//
+// Each process has a weight (see setweight()), and gets a
+// share of the CPUs in proportion to it. A process's
+// vruntime is the time it has run, in cycles of the time CSR,
+// scaled by DEFWEIGHT/weight, so that it grows more slowly
+// the heavier the process is. The RUNNABLE processes are kept
+// in an AVL tree ordered by vruntime, and a CPU runs the one
+// with the least. On each clock tick the running process
+// gives up the CPU if it has got ahead of that one.
+//
+// There is one tree for all the CPUs, not one per CPU as
+// with the feedback queues: shares are fair only among
+// processes that compete for the same CPUs.
+//
+// A process that wakes up, or is new, joins with at least
+// the vruntime of the last process picked, less a tick: it
+// runs soon, but can't claim the time it spent asleep.
+//
+// The tree's lock protects its links and the vruntime of the
+// processes in it. It is taken after p->lock.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+struct {
+  struct spinlock lock;
+  struct proc *root;
+  uint64 minvrun;     // vruntime of the last process picked
+} cfs;
+
+void
+cfsinit(void)
+{
+  initlock(&cfs.lock, "cfs");
+}
+
+// does a run before b?
+static int
+before(struct proc *a, struct proc *b)
+{
+  if(a->vruntime != b->vruntime)
+    return a->vruntime < b->vruntime;
+  return a < b;
+}
+
+static int
+height(struct proc *p)
+{
+  return p ? p->rqheight : 0;
+}
+
+static void
+update(struct proc *p)
+{
+  int l = height(p->rqleft), r = height(p->rqright);
+
+  p->rqheight = (l > r ? l : r) + 1;
+}
+
+static struct proc*
+rotright(struct proc *p)
+{
+  struct proc *l = p->rqleft;
+
+  p->rqleft = l->rqright;
+  l->rqright = p;
+  update(p);
+  update(l);
+  return l;
+}
+
+static struct proc*
+rotleft(struct proc *p)
+{
+  struct proc *r = p->rqright;
+
+  p->rqright = r->rqleft;
+  r->rqleft = p;
+  update(p);
+  update(r);
+  return r;
+}
+
+// restore the balance of p, whose subtrees are balanced and
+// differ in height by at most two. returns the new root.
+static struct proc*
+balance(struct proc *p)
+{
+  int b = height(p->rqleft) - height(p->rqright);
+
+  if(b > 1){
+    if(height(p->rqleft->rqleft) < height(p->rqleft->rqright))
+      p->rqleft = rotleft(p->rqleft);
+    return rotright(p);
+  }
+  if(b < -1){
+    if(height(p->rqright->rqright) < height(p->rqright->rqleft))
+      p->rqright = rotright(p->rqright);
+    return rotleft(p);
+  }
+  update(p);
+  return p;
+}
+
+static struct proc*
+insert(struct proc *root, struct proc *p)
+{
+  if(root == 0)
+    return p;
+  if(before(p, root))
+    root->rqleft = insert(root->rqleft, p);
+  else
+    root->rqright = insert(root->rqright, p);
+  return balance(root);
+}
+
+// remove the leftmost process of root, setting *min to it.
+static struct proc*
+removemin(struct proc *root, struct proc **min)
+{
+  if(root->rqleft == 0){
+    *min = root;
+    return root->rqright;
+  }
+  root->rqleft = removemin(root->rqleft, min);
+  return balance(root);
+}
+
+// Charge p, which has been running, for the time since it
+// started (p->start).
+// Caller must hold p->lock, and p must not be in the tree.
+void
+cfscharge(struct proc *p)
+{
+  uint64 now = r_time();
+
+  p->vruntime += (now - p->start) * DEFWEIGHT / p->weight;
+  p->start = now;
+}
+
+// Put p, which has just become RUNNABLE, in the tree.
+// Caller must hold p->lock.
+void
+cfsenqueue(struct proc *p)
+{
+  acquire(&cfs.lock);
+  if(cfs.minvrun > TICKCYCLES && p->vruntime < cfs.minvrun - TICKCYCLES)
+    p->vruntime = cfs.minvrun - TICKCYCLES;
+  p->rqleft = p->rqright = 0;
+  p->rqheight = 1;
+  cfs.root = insert(cfs.root, p);
+  release(&cfs.lock);
+}
+
+// Take the process with the least vruntime out of the tree,
+// or return 0 if it's empty.
+struct proc*
+cfspick(void)
+{
+  struct proc *p = 0;
+
+  acquire(&cfs.lock);
+  if(cfs.root){
+    cfs.root = removemin(cfs.root, &p);
+    if(p->vruntime > cfs.minvrun)
+      cfs.minvrun = p->vruntime;
+  }
+  release(&cfs.lock);
+  return p;
+}
+
+// Should p, which is running, give up the CPU? Yes if a
+// RUNNABLE process has less vruntime than p would have if
+// charged now.
+// Caller must hold p->lock.
+int
+cfspreempt(struct proc *p)
+{
+  struct proc *l;
+  uint64 v;
+  int r = 0;
+
+  v = p->vruntime + (r_time() - p->start) * DEFWEIGHT / p->weight;
+  acquire(&cfs.lock);
+  if((l = cfs.root) != 0){
+    while(l->rqleft)
+      l = l->rqleft;
+    r = l->vruntime < v;
+  }
+  release(&cfs.lock);
+  return r;
+}
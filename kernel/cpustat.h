@@ -0,0 +1,8 @@
+// Per-CPU statistics, filled in by the cpustat() system call.
+
+struct cpustat {
+  uint64 started;     // time CSR when the CPU started scheduling, or 0
+  uint64 idletime;    // time (in time CSR ticks) spent idle, in wfi
+  uint64 nidle;       // times it went idle
+  uint64 nwake;       // IPIs that woke it
+};
@@ -1,13 +1,19 @@
 struct buf;
 struct context;
+struct cpustat;
 struct file;
 struct inode;
+struct kmem_cache;
+struct memstat;
 struct pipe;
 struct proc;
+struct spawnfd;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vma;
+struct vmatree;
 
 // bio.c
 void            binit(void);
@@ -24,6 +30,10 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             execproc(struct proc*, char*, char**);
+void            execinit(void);
+int             execfault(struct vma*, uint64, int);
+int             droptext(void);
 
 // file.c
 struct file*    filealloc(void);
@@ -43,6 +53,7 @@ struct inode*   idup(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
 void            iput(struct inode*);
+int             ikeep(struct inode*, int);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
@@ -61,8 +72,17 @@ void            ramdiskrw(struct buf*);
 
 // kalloc.c
 void*           kalloc(void);
+void*           kalloc_zeroed(void);
+int             kzero(void);
 void            kfree(void *);
 void            kinit(void);
+void*           kalloc_pages(int);
+void            kfree_pages(void *, int);
+void            kref_pages(void *, int);
+void            ksplit(void *);
+void            kmemstat(struct memstat*);
+void            kref(void *);
+int             krefcnt(void *);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -70,7 +90,22 @@ void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
 
+// mmap.c
+uint64          mmap(uint64, uint64, int, int, struct file*, uint64);
+int             munmap(uint64, uint64);
+int             mmapfault(struct vma*, uint64, int);
+void            mmapunmap(struct proc*, struct vma*, uint64, uint64);
+
+// pcache.c
+void            pcacheinit(void);
+char*           pcache_get(struct inode*, uint64);
+int             pcache_add(struct inode*, uint64, char*);
+void            pcache_write(struct inode*, uint64, void*, uint);
+void            pcache_put(struct inode*, uint64);
+void            pcache_purge(struct inode*);
+
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -85,10 +120,15 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             spawn(char*, char**, struct spawnfd*, int);
+int             setpriority(int, int);
+int             setweight(int, int);
+int             cpustats(struct cpustat*);
+void            schedtick(void);
 int             growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
-void            proc_freepagetable(pagetable_t, uint64);
+void            proc_freepagetable(pagetable_t);
 int             kill(int);
 int             killed(struct proc*);
 void            setkilled(struct proc*);
@@ -107,9 +147,55 @@ int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
 
+// cfs.c
+void            cfsinit(void);
+void            cfscharge(struct proc*);
+void            cfsenqueue(struct proc*);
+struct proc*    cfspick(void);
+int             cfspreempt(struct proc*);
+
+// swap.c
+void            swapinit(void);
+void            swapdup(uint64);
+void            swapfree(uint64);
+int             swapin(pte_t*);
+int             reclaim(void);
+void*           ualloc(int);
+void            swapstat(struct memstat*);
+
+// ksm.c
+void            ksminit(void);
+int             ksmscan(void);
+int             ksmrate(int);
+void            ksmstat(struct memstat*);
+
+// zram.c
+void            zraminit(void);
+int             zram_store(char*);
+void            zram_load(int, char*);
+void            zram_dup(int);
+void            zram_free(int);
+void            zram_refill(void);
+void            zramstat(struct memstat*);
+
 // swtch.S
 void            swtch(struct context*, struct context*);
 
+// usercopy.S
+int             ucopy(void*, void*, uint64);
+int             ucopystr(char*, char*, uint64);
+
+// vstring.S
+void*           vmemmove(void*, const void*, uint);
+void*           vmemset(void*, int, uint);
+int             vmemcmp(const void*, const void*, uint);
+
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
@@ -125,6 +211,7 @@ int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
 // string.c
+extern int      hasvector;
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
 void*           memset(void*, int, uint);
@@ -148,6 +235,11 @@ void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
 
+// timer.c
+void            wheelinit(void);
+int             timerintr(void);
+int             sleepuntil(uint64);
+
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
@@ -155,20 +247,45 @@ void            uartputc(int);
 void            uartputc_sync(int);
 int             uartgetc(void);
 
+// vma.c
+void            vmainit(void);
+struct vma*     vmalookup(struct vmatree*, uint64);
+struct vma*     vmanext(struct vmatree*, uint64);
+struct vma*     vmaadd(struct vmatree*, uint64, uint64, int, int);
+void            vmaclear(struct vmatree*);
+int             vmaremove(struct proc*, uint64, uint64);
+int             vmagrow(struct proc*, uint64, uint64);
+void            vmafree(struct proc*);
+int             vmadup(struct proc*, struct proc*);
+int             vmaperm(struct vma*);
+
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
+void            asidinit(void);
+uint64          uvmasid(struct proc*);
+void            tlbflush(struct proc*, uint64);
+void            uvmwindow(pagetable_t);
+void            uvmstat(struct memstat*);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
 void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
-int             uvmcopy(pagetable_t, pagetable_t, uint64);
-void            uvmfree(pagetable_t, uint64);
+int             uvmcopy(pagetable_t, pagetable_t, uint64, uint64);
+int             uvmcow(pagetable_t, uint64);
+int             uvmsplit(pagetable_t, uint64);
+int             uvmcut(pagetable_t, uint64);
+int             vmfault(pagetable_t, uint64, int);
+void            uvmprefault(uint64, uint64, int);
+pte_t *         uvmnext(pagetable_t, uint64*);
+void            uvmbegin(void);
+void            uvmend(void);
+void            uvmfree(pagetable_t);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
-void            uvmclear(pagetable_t, uint64);
 pte_t *         walk(pagetable_t, uint64, int);
+pte_t *         walklevel(pagetable_t, uint64, int, int*);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
@@ -181,9 +298,10 @@ int             plic_claim(void);
 void            plic_complete(int);
 
 // virtio_disk.c
-void            virtio_disk_init(void);
+uint64          virtio_disk_init(int);
 void            virtio_disk_rw(struct buf *, int);
-void            virtio_disk_intr(void);
+void            virtio_disk_rwpage(int, uint64, void *, int);
+void            virtio_disk_intr(int);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
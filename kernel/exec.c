@@ -5,31 +5,51 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
 #include "elf.h"
+#include "fcntl.h"
 
-static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
+static void keeptext(struct inode *);
 
-int flags2perm(int flags)
+// recently run programs, most recent first.
+struct {
+  struct spinlock lock;
+  struct inode *ip[NTEXT];
+} texts;
+
+void
+execinit(void)
 {
-    int perm = 0;
+  initlock(&texts.lock, "texts");
+}
+
+int flags2prot(int flags)
+{
+    int prot = PROT_READ;
     if(flags & 0x1)
-      perm = PTE_X;
+      prot |= PROT_EXEC;
     if(flags & 0x2)
-      perm |= PTE_W;
-    return perm;
+      prot |= PROT_WRITE;
+    return prot;
 }
 
+// Replace p's user memory with the program at path, run
+// with arguments argv. p is the current process, or a new
+// one that spawn() is setting up.
 int
-exec(char *path, char **argv)
+execproc(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
   int i, off;
   uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *exe = 0, *oldexe;
   struct proghdr ph;
+  struct vmatree vmas = { 0 };
+  struct vma *v;
   pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
 
   begin_op();
 
@@ -61,29 +81,38 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
+    if(ph.vaddr + ph.memsz > TRAPFRAME || ph.off + ph.filesz < ph.off ||
+       ph.off + ph.filesz > ip->size)
       goto bad;
-    sz = sz1;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.memsz == 0)
+      continue;
+    // read the segment in a page at a time, as it is
+    // touched; see execfault().
+    v = vmaadd(&vmas, ph.vaddr, PGROUNDUP(ph.vaddr + ph.memsz),
+               flags2prot(ph.flags), VMA_EXEC);
+    if(v == 0)
       goto bad;
+    v->off = ph.off;
+    v->filesz = ph.filesz;
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
   }
-  iunlockput(ip);
+  // keep a reference to the program file, to read
+  // segments from.
+  iunlock(ip);
   end_op();
+  exe = ip;
   ip = 0;
 
-  p = myproc();
-  uint64 oldsz = p->sz;
-
-  // Allocate two pages at the next page boundary.
-  // Make the first inaccessible as a stack guard.
-  // Use the second as the user stack.
-  sz = PGROUNDUP(sz);
-  uint64 sz1;
-  if((sz1 = uvmalloc(pagetable, sz, sz + 2*PGSIZE, PTE_W)) == 0)
+  // Leave the page at the next page boundary unmapped,
+  // as a stack guard, and use the one above it as the
+  // user stack. The heap grows up from the stack.
+  sz = PGROUNDUP(sz) + PGSIZE;
+  if(vmaadd(&vmas, sz, sz + PGSIZE, PROT_READ|PROT_WRITE, VMA_ANON) == 0)
     goto bad;
-  sz = sz1;
-  uvmclear(pagetable, sz-2*PGSIZE);
+  if(uvmalloc(pagetable, sz, sz + PGSIZE, PTE_W) == 0)
+    goto bad;
+  sz += PGSIZE;
   sp = sz;
   stackbase = sp - PGSIZE;
 
@@ -121,46 +150,147 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
+  vmafree(p);
   oldpagetable = p->pagetable;
+  oldexe = p->exe;
   p->pagetable = pagetable;
+  p->asid = 0;  // the TLB may hold the old page table's entries
+  p->winok = 0;
+  if(p == myproc())
+    uvmwindow(pagetable);
+  p->vmas = vmas;
   p->sz = sz;
+  p->exe = exe;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
-  proc_freepagetable(oldpagetable, oldsz);
+  proc_freepagetable(oldpagetable);
+  begin_op();
+  keeptext(exe);
+  if(oldexe)
+    iput(oldexe);
+  end_op();
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
  bad:
   if(pagetable)
-    proc_freepagetable(pagetable, sz);
+    proc_freepagetable(pagetable);
+  vmaclear(&vmas);
   if(ip){
     iunlockput(ip);
     end_op();
   }
+  if(exe){
+    begin_op();
+    iput(exe);
+    end_op();
+  }
   return -1;
 }
 
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
+int
+exec(char *path, char **argv)
+{
+  return execproc(myproc(), path, argv);
+}
+
+// Read in the page at va of the current process's program,
+// in its region v, on the first access to it: the part of
+// the page backed by the file comes from the segment's file
+// data, and the rest is zeroed. A read-only page that is all file data is
+// shared, through the page cache, with every process
+// running the program.
+// Returns 0 if the page is now mapped and allows the access,
+// -1 if the access is not allowed or the page can't be read.
+int
+execfault(struct vma *v, uint64 va, int write)
 {
-  uint i, n;
-  uint64 pa;
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
+  struct proc *p = myproc();
+  struct inode *ip = p->exe;
+  uint64 segoff, off, n = 0;
+  char *mem = 0;
+  int locked, shared;
+
+  va = PGROUNDDOWN(va);
+  if(ip == 0 || (write && (v->prot & PROT_WRITE) == 0))
+    return -1;
+
+  segoff = va - v->start;
+  off = v->off + segoff;
+  if(segoff < v->filesz){
+    n = v->filesz - segoff;
+    if(n > PGSIZE)
       n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
   }
-  
+  shared = (v->prot & PROT_WRITE) == 0 && n == PGSIZE && off % PGSIZE == 0;
+
+  // the process already holds the lock if read() or
+  // write() is copying to or from its own program file,
+  // and no other inode's: they fault program pages in
+  // first, with uvmprefault().
+  locked = holdingsleep(&ip->lock);
+  if(!locked)
+    ilock(ip);
+  if(shared)
+    mem = pcache_get(ip, off);
+  if(mem == 0 && (mem = ualloc(1)) != 0){
+    if((n > 0 && readi(ip, 0, (uint64)mem, off, n) != n) ||
+       (shared && pcache_add(ip, off, mem) != 0)){
+      kfree(mem);
+      mem = 0;
+    }
+  }
+  if(!locked)
+    iunlock(ip);
+
+  if(mem == 0)
+    return -1;
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, vmaperm(v)) != 0){
+    kfree(mem);
+    return -1;
+  }
   return 0;
 }
+
+// Make ip the most recently run program, keeping its
+// cached text pages (see ikeep()) after the processes
+// running it exit, until NTEXT other programs have run
+// or reclaim() needs the memory.
+static void
+keeptext(struct inode *ip)
+{
+  struct inode *old;
+  int i;
+
+  acquire(&texts.lock);
+  for(i = 0; i < NTEXT-1 && texts.ip[i] != ip; i++)
+    ;
+  old = texts.ip[i];
+  if(old == ip)
+    old = 0;
+  memmove(&texts.ip[1], &texts.ip[0], i * sizeof(texts.ip[0]));
+  texts.ip[0] = ip;
+  ikeep(ip, 1);
+  if(old)
+    ikeep(old, 0);
+  release(&texts.lock);
+}
+
+// Stop keeping the cached text of the least recently run
+// programs, for reclaim(), until one that no process is
+// running has freed some pages. Returns how many.
+int
+droptext(void)
+{
+  int i, n = 0;
+
+  acquire(&texts.lock);
+  for(i = NTEXT-1; i >= 0 && n == 0; i--){
+    if(texts.ip[i]){
+      n = ikeep(texts.ip[i], 0);
+      texts.ip[i] = 0;
+    }
+  }
+  release(&texts.lock);
+  return n;
+}
@@ -18,6 +18,8 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  int ncached;        // pages in the page cache; only grows with lock held
+  int keep;           // keep cached pages with no references; see ikeep()
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -243,6 +243,9 @@ iupdate(struct inode *ip)
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
+// An entry with no references that ikeep() kept is
+// still a valid copy; it is recycled only if no
+// other entry is free, dropping its cached pages.
 static struct inode*
 iget(uint dev, uint inum)
 {
@@ -253,13 +256,13 @@ iget(uint dev, uint inum)
   // Is the inode already in the table?
   empty = 0;
   for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+    if((ip->ref > 0 || ip->keep) && ip->dev == dev && ip->inum == inum){
       ip->ref++;
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
+    if(ip->ref == 0 && (empty == 0 || (empty->keep && !ip->keep)))
+      empty = ip;    // Remember empty slot.
   }
 
   // Recycle an inode entry.
@@ -267,6 +270,10 @@ iget(uint dev, uint inum)
     panic("iget: no inodes");
 
   ip = empty;
+  if(ip->keep){
+    ip->keep = 0;
+    pcache_purge(ip);
+  }
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
@@ -338,6 +345,12 @@ iput(struct inode *ip)
 {
   acquire(&itable.lock);
 
+  if(ip->ref == 1 && ip->valid && ip->nlink == 0)
+    ip->keep = 0;
+
+  if(ip->ref == 1 && ip->ncached && !ip->keep)
+    pcache_purge(ip);
+
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
 
@@ -361,6 +374,26 @@ iput(struct inode *ip)
   release(&itable.lock);
 }
 
+// Keep ip's cached pages, and its inode table entry, after
+// its last reference goes, if keep is set; exec() does, for
+// recently run programs. Or stop keeping them, dropping the
+// pages now if ip has no references. Returns the number of
+// pages dropped.
+int
+ikeep(struct inode *ip, int keep)
+{
+  int n = 0;
+
+  acquire(&itable.lock);
+  ip->keep = keep;
+  if(!keep && ip->ref == 0 && ip->ncached){
+    n = ip->ncached;
+    pcache_purge(ip);
+  }
+  release(&itable.lock);
+  return n;
+}
+
 // Common idiom: unlock, then put.
 void
 iunlockput(struct inode *ip)
@@ -473,6 +506,8 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  char *pa;
+  int r;
 
   if(off > ip->size || off + n < off)
     return 0;
@@ -480,11 +515,21 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    m = min(n - tot, BSIZE - off%BSIZE);
+    if(ip->ncached && (pa = pcache_get(ip, off)) != 0){
+      // a mapped page may be newer than the disk.
+      r = either_copyout(user_dst, dst, pa + off%PGSIZE, m);
+      kfree(pa);
+      if(r == -1){
+        tot = -1;
+        break;
+      }
+      continue;
+    }
     uint addr = bmap(ip, off/BSIZE);
     if(addr == 0)
       break;
     bp = bread(ip->dev, addr);
-    m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
       brelse(bp);
       tot = -1;
@@ -523,6 +568,8 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       brelse(bp);
       break;
     }
+    if(ip->ncached)
+      pcache_write(ip, off, bp->data + (off % BSIZE), m);
     log_write(bp);
     brelse(bp);
   }
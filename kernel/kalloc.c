@@ -1,6 +1,36 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers.
+//
+// Memory is managed by a buddy allocator that hands out
+// physically contiguous blocks of 2^order pages, for
+// order 0 (4 KiB) up to MAXORDER (2 MiB). Freed blocks
+// are merged with their buddies when both are free.
+//
+// Single pages (kalloc()/kfree()) are the common case, so
+// each CPU keeps a cache of free order-0 pages, protected by
+// its own lock, which it refills from and drains to the buddy
+// allocator a batch at a time. A CPU that finds both its cache
+// and the buddy allocator empty steals a batch of pages from
+// another CPU's cache.
+//
+// Allocated blocks are reference counted, so that pages can
+// be shared (e.g. by copy-on-write fork): kfree() only frees
+// a page once the last reference is dropped.
+//
+// Idle CPUs zero free pages ahead of time into a pool that
+// kalloc_zeroed() takes from, so that callers that need a
+// zeroed page don't have to clear it themselves.
+//
+// Build with KALLOC_JUNK=1 to fill freed and newly allocated
+// memory with junk, to catch dangling references and use of
+// uninitialized memory.
+//
+// ksplit() turns an allocated block into single pages that
+// can be freed one at a time, e.g. when part of a megapage
+// is unmapped. Other holders of the block may still treat
+// it as a block; kref_pages() and kfree_pages() take
+// buddy.lock to see consistently whether it was split.
 
 #include "types.h"
 #include "param.h"
@@ -8,58 +38,404 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "defs.h"
+#include "memstat.h"
 
 void freerange(void *pa_start, void *pa_end);
 
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
+#define MAXORDER (NORDER-1)
+
+// per-CPU cache sizing, in pages.
+#define PCPBATCH 32          // pages moved to/from the buddy allocator at a time
+#define PCPHIGH  (4*PCPBATCH) // drain to the buddy allocator above this
+
+// how many pages a CPU takes at a time from another CPU's cache.
+#define STEALBATCH 32
+
+// how many zeroed pages idle CPUs keep ready.
+#define ZPOOLSIZE 256
+
+// page frame number of physical address pa, and back.
+#define NPAGES ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PA2PFN(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+#define PFN2PA(pfn) (KERNBASE + (uint64)(pfn) * PGSIZE)
+
+// a free page or block. the buddy free lists are
+// doubly linked so that a block can be removed when
+// it merges with its buddy; the per-CPU caches only
+// use next.
 struct run {
   struct run *next;
+  struct run *prev;
+};
+
+// per-page bookkeeping.
+struct page {
+  uchar order;  // order of the block that starts at this page
+  uchar free;   // is that block on a buddy free list?
+  int ref;      // references to an allocated block, kept in its first page
 };
 
 struct {
+  struct spinlock lock;
+  struct run free[NORDER];  // list heads, one per order
+  uint64 nfree[NORDER];
+  struct page pages[NPAGES];
+} buddy;
+
+struct kmem {
   struct spinlock lock;
   struct run *freelist;
-} kmem;
+  int nfree;
+
+  // allocation statistics, updated only by this CPU
+  // with interrupts off.
+  uint64 nalloc[NORDER];
+  uint64 nfail[NORDER];
+  uint64 alloctime[NORDER];
+  uint64 maxalloctime[NORDER];
+};
+
+struct kmem kmem[NCPU];
+
+// free pages that have been zeroed, linked through their
+// first word.
+struct {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+} zpool;
 
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
+  initlock(&buddy.lock, "buddy");
+  for(int k = 0; k < NORDER; k++){
+    buddy.free[k].next = &buddy.free[k];
+    buddy.free[k].prev = &buddy.free[k];
+  }
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kmem[i].lock, "kmem");
+  initlock(&zpool.lock, "zpool");
   freerange(end, (void*)PHYSTOP);
 }
 
+static void
+buddy_insert(uint64 pfn, int order)
+{
+  struct run *r = (struct run*)PFN2PA(pfn);
+  struct run *head = &buddy.free[order];
+
+  buddy.pages[pfn].order = order;
+  buddy.pages[pfn].free = 1;
+  r->next = head->next;
+  r->prev = head;
+  head->next->prev = r;
+  head->next = r;
+  buddy.nfree[order]++;
+}
+
+static void
+buddy_remove(uint64 pfn, int order)
+{
+  struct run *r = (struct run*)PFN2PA(pfn);
+
+  buddy.pages[pfn].free = 0;
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+  buddy.nfree[order]--;
+}
+
+// Allocate a block of 2^order pages, splitting a larger
+// block if needed. Returns its page frame number, or -1.
+// Caller must hold buddy.lock.
+static int
+buddy_alloc(int order)
+{
+  struct run *r;
+  uint64 pfn;
+  int k;
+
+  for(k = order; k <= MAXORDER; k++)
+    if(buddy.free[k].next != &buddy.free[k])
+      break;
+  if(k > MAXORDER)
+    return -1;
+
+  r = buddy.free[k].next;
+  pfn = PA2PFN(r);
+  buddy_remove(pfn, k);
+
+  // put the unused upper halves back, one per order.
+  while(k > order){
+    k--;
+    buddy_insert(pfn + (1L << k), k);
+  }
+  buddy.pages[pfn].order = order;
+  return pfn;
+}
+
+// Free the block of 2^order pages starting at pfn, merging
+// it with its buddy for as long as the buddy is free too.
+// Caller must hold buddy.lock.
+static void
+buddy_free(uint64 pfn, int order)
+{
+  uint64 bpfn;
+
+  if(buddy.pages[pfn].free)
+    panic("kfree: double free");
+
+  while(order < MAXORDER){
+    bpfn = pfn ^ (1L << order);
+    if(bpfn >= NPAGES || !buddy.pages[bpfn].free ||
+       buddy.pages[bpfn].order != order)
+      break;
+    buddy_remove(bpfn, order);
+    if(bpfn < pfn)
+      pfn = bpfn;
+    order++;
+  }
+  buddy_insert(pfn, order);
+}
+
+// Hand pa_start..pa_end to the buddy allocator, in the
+// largest naturally aligned blocks that fit.
 void
 freerange(void *pa_start, void *pa_end)
 {
-  char *p;
-  p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  uint64 pfn, last;
+  int k;
+
+  pfn = PA2PFN(PGROUNDUP((uint64)pa_start));
+  last = PA2PFN(PGROUNDDOWN((uint64)pa_end));
+  acquire(&buddy.lock);
+  while(pfn < last){
+    for(k = MAXORDER; k > 0; k--)
+      if((pfn & ((1L << k) - 1)) == 0 && pfn + (1L << k) <= last)
+        break;
+#ifdef KALLOC_JUNK
+    // Fill with junk to catch dangling refs.
+    memset((void*)PFN2PA(pfn), 1, PGSIZE << k);
+#endif
+    buddy_free(pfn, k);
+    pfn += 1L << k;
+  }
+  release(&buddy.lock);
 }
 
-// Free the page of physical memory pointed at by pa,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Record an allocation of the given order that started at
+// time t0 on this CPU. Interrupts must be off.
+static void
+kstat(int order, uint64 t0, int ok)
+{
+  struct kmem *km = &kmem[cpuid()];
+  uint64 t = r_time() - t0;
+
+  if(!ok){
+    km->nfail[order]++;
+    return;
+  }
+  km->nalloc[order]++;
+  km->alloctime[order] += t;
+  if(t > km->maxalloctime[order])
+    km->maxalloctime[order] = t;
+}
+
+// Add a reference to the block starting at pa.
+void
+kref(void *pa)
+{
+  __sync_fetch_and_add(&buddy.pages[PA2PFN(pa)].ref, 1);
+}
+
+// Drop a reference to the block starting at pa.
+// Returns the number of references left.
+static int
+kderef(void *pa)
+{
+  int ref = __sync_sub_and_fetch(&buddy.pages[PA2PFN(pa)].ref, 1);
+
+  if(ref < 0)
+    panic("kderef");
+  return ref;
+}
+
+// Return the number of references to the block starting at pa.
+int
+krefcnt(void *pa)
+{
+  return buddy.pages[PA2PFN(pa)].ref;
+}
+
+// Drop a reference to the page of physical memory pointed
+// at by pa, which normally should have been returned by a
+// call to kalloc(), and free it if that was the last one.
 void
 kfree(void *pa)
 {
-  struct run *r;
+  struct run *r, *drain;
+  struct kmem *km;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  if(kderef(pa) > 0)
+    return;
+
+#ifdef KALLOC_JUNK
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
+  drain = 0;
+
+  push_off();
+  km = &kmem[cpuid()];
+  acquire(&km->lock);
+  r->next = km->freelist;
+  km->freelist = r;
+  km->nfree++;
+  if(km->nfree > PCPHIGH){
+    // too many cached pages; give a batch back to the
+    // buddy allocator so they can merge.
+    drain = km->freelist;
+    for(int i = 0; i < PCPBATCH; i++){
+      r = km->freelist;
+      km->freelist = r->next;
+    }
+    r->next = 0;
+    km->nfree -= PCPBATCH;
+  }
+  release(&km->lock);
+  pop_off();
+
+  if(drain){
+    acquire(&buddy.lock);
+    while(drain){
+      r = drain;
+      drain = r->next;
+      buddy_free(PA2PFN(r), 0);
+    }
+    release(&buddy.lock);
+  }
+}
+
+// Move up to STEALBATCH pages from some other CPU's cache
+// to CPU id's cache. Only one kmem lock is held at a
+// time, so two CPUs stealing from each other can't deadlock.
+// Returns the number of pages stolen.
+static int
+steal(int id)
+{
+  struct run *head, *tail;
+  struct kmem *victim;
+  int n;
+
+  for(int i = 1; i < NCPU; i++){
+    victim = &kmem[(id + i) % NCPU];
+    if(victim->nfree == 0)  // racy peek, just a hint
+      continue;
+
+    acquire(&victim->lock);
+    head = tail = victim->freelist;
+    n = 0;
+    if(head){
+      // take half the victim's pages, up to a batch.
+      n = 1;
+      while(n < STEALBATCH && n < (victim->nfree+1)/2 && tail->next){
+        tail = tail->next;
+        n++;
+      }
+      victim->freelist = tail->next;
+      victim->nfree -= n;
+    }
+    release(&victim->lock);
+
+    if(n > 0){
+      acquire(&kmem[id].lock);
+      tail->next = kmem[id].freelist;
+      kmem[id].freelist = head;
+      kmem[id].nfree += n;
+      release(&kmem[id].lock);
+      return n;
+    }
+  }
+  return 0;
+}
+
+// Move a batch of single pages from the buddy allocator
+// to CPU id's cache. Returns the number of pages moved.
+static int
+refill(int id)
+{
+  struct run *head = 0, *r;
+  int pfn;
+  int n;
+
+  acquire(&buddy.lock);
+  for(n = 0; n < PCPBATCH; n++){
+    if((pfn = buddy_alloc(0)) < 0)
+      break;
+    r = (struct run*)PFN2PA(pfn);
+    r->next = head;
+    head = r;
+  }
+  release(&buddy.lock);
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  if(n > 0){
+    acquire(&kmem[id].lock);
+    for(r = head; r->next; r = r->next)
+      ;
+    r->next = kmem[id].freelist;
+    kmem[id].freelist = head;
+    kmem[id].nfree += n;
+    release(&kmem[id].lock);
+  }
+  return n;
+}
+
+// Take a free page from CPU id's cache, refilling the cache
+// from the buddy allocator or other CPUs' caches if it's
+// empty. Returns 0 if there are none. Interrupts must be off.
+static struct run*
+allocpage(int id)
+{
+  struct kmem *km = &kmem[id];
+  struct run *r;
+
+  for(;;){
+    acquire(&km->lock);
+    r = km->freelist;
+    if(r){
+      km->freelist = r->next;
+      km->nfree--;
+    }
+    release(&km->lock);
+
+    if(r || (refill(id) == 0 && steal(id) == 0))
+      return r;
+  }
+}
+
+// Take a page from the pool of zeroed pages, or return 0
+// if it is empty.
+static struct run*
+zpool_get(void)
+{
+  struct run *r;
+
+  acquire(&zpool.lock);
+  r = zpool.freelist;
+  if(r){
+    zpool.freelist = r->next;
+    zpool.nfree--;
+  }
+  release(&zpool.lock);
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -69,14 +445,219 @@ void *
 kalloc(void)
 {
   struct run *r;
+  uint64 t0;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  push_off();
+  t0 = r_time();
+  r = allocpage(cpuid());
+  if(r == 0)
+    r = zpool_get();  // last resort
+  kstat(0, t0, r != 0);
+  pop_off();
 
-  if(r)
+  if(r){
+    buddy.pages[PA2PFN(r)].ref = 1;
+#ifdef KALLOC_JUNK
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
+  }
   return (void*)r;
 }
+
+// Allocate one zero-filled page of physical memory,
+// preferably one that an idle CPU has already zeroed.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
+  uint64 t0;
+
+  push_off();
+  t0 = r_time();
+  r = zpool_get();
+  if(r)
+    kstat(0, t0, 1);
+  pop_off();
+
+  if(r == 0){
+    if((r = kalloc()) != 0)
+      memset(r, 0, PGSIZE);
+    return (void*)r;
+  }
+  buddy.pages[PA2PFN(r)].ref = 1;
+  r->next = 0;
+  return (void*)r;
+}
+
+// Called by a CPU's scheduler when it has nothing to run:
+// zero a free page for kalloc_zeroed(), if the pool isn't
+// full. Returns 1 if it zeroed a page.
+int
+kzero(void)
+{
+  struct run *r;
+
+  if(zpool.nfree >= ZPOOLSIZE)  // racy peek, just a hint
+    return 0;
+
+  push_off();
+  r = allocpage(cpuid());
+  pop_off();
+  if(r == 0)
+    return 0;
+  memset(r, 0, PGSIZE);
+
+  acquire(&zpool.lock);
+  r->next = zpool.freelist;
+  zpool.freelist = r;
+  zpool.nfree++;
+  release(&zpool.lock);
+  return 1;
+}
+
+// Allocate 2^order physically contiguous pages, aligned
+// to their size. Returns 0 if no large enough block is free.
+void *
+kalloc_pages(int order)
+{
+  int pfn;
+  uint64 t0;
+  void *pa;
+
+  if(order < 0 || order > MAXORDER)
+    panic("kalloc_pages");
+  if(order == 0)
+    return kalloc();
+
+  push_off();
+  t0 = r_time();
+  acquire(&buddy.lock);
+  pfn = buddy_alloc(order);
+  release(&buddy.lock);
+  kstat(order, t0, pfn >= 0);
+  pop_off();
+
+  if(pfn < 0)
+    return 0;
+  pa = (void*)PFN2PA(pfn);
+  buddy.pages[pfn].ref = 1;
+#ifdef KALLOC_JUNK
+  memset(pa, 5, PGSIZE << order); // fill with junk
+#endif
+  return pa;
+}
+
+// Split the allocated block starting at pa into single
+// pages, each with the block's references, which are then
+// freed with kfree(). Does nothing if pa is already a
+// single page.
+void
+ksplit(void *pa)
+{
+  uint64 pfn = PA2PFN(pa);
+  int order;
+
+  acquire(&buddy.lock);
+  order = buddy.pages[pfn].order;
+  for(int i = 1; i < (1 << order); i++){
+    buddy.pages[pfn+i].order = 0;
+    buddy.pages[pfn+i].ref = buddy.pages[pfn].ref;
+  }
+  buddy.pages[pfn].order = 0;
+  release(&buddy.lock);
+}
+
+// Add a reference to a block returned by kalloc_pages(order),
+// or to each of its pages if it has since been split.
+void
+kref_pages(void *pa, int order)
+{
+  uint64 pfn = PA2PFN(pa);
+
+  acquire(&buddy.lock);
+  if(buddy.pages[pfn].order == order){
+    kref(pa);
+  } else {
+    for(int i = 0; i < (1 << order); i++)
+      kref((char*)pa + i*PGSIZE);
+  }
+  release(&buddy.lock);
+}
+
+// Drop a reference to a block returned by kalloc_pages(order),
+// and free it if that was the last one. If the block has
+// been split, drop a reference to each of its pages.
+void
+kfree_pages(void *pa, int order)
+{
+  int split, ref = 0;
+
+  if(order < 0 || order > MAXORDER)
+    panic("kfree_pages");
+  if(order == 0){
+    kfree(pa);
+    return;
+  }
+
+  if(((uint64)pa % (PGSIZE << order)) != 0 || (char*)pa < end ||
+     (uint64)pa + (PGSIZE << order) > PHYSTOP)
+    panic("kfree_pages");
+
+  acquire(&buddy.lock);
+  split = buddy.pages[PA2PFN(pa)].order != order;
+  if(!split)
+    ref = kderef(pa);
+  release(&buddy.lock);
+
+  if(split){
+    for(int i = 0; i < (1 << order); i++)
+      kfree((char*)pa + i*PGSIZE);
+    return;
+  }
+  if(ref > 0)
+    return;
+
+#ifdef KALLOC_JUNK
+  // Fill with junk to catch dangling refs.
+  memset(pa, 1, PGSIZE << order);
+#endif
+
+  acquire(&buddy.lock);
+  buddy_free(PA2PFN(pa), order);
+  release(&buddy.lock);
+}
+
+// Fill in *st with a snapshot of the allocator's state.
+void
+kmemstat(struct memstat *st)
+{
+  memset(st, 0, sizeof(*st));
+
+  acquire(&buddy.lock);
+  for(int k = 0; k < NORDER; k++){
+    st->nfree[k] = buddy.nfree[k];
+    st->freepages += buddy.nfree[k] << k;
+  }
+  release(&buddy.lock);
+
+  for(int i = 0; i < NCPU; i++){
+    struct kmem *km = &kmem[i];
+    acquire(&km->lock);
+    st->cachedpages += km->nfree;
+    for(int k = 0; k < NORDER; k++){
+      st->nalloc[k] += km->nalloc[k];
+      st->nfail[k] += km->nfail[k];
+      st->alloctime[k] += km->alloctime[k];
+      if(km->maxalloctime[k] > st->maxalloctime[k])
+        st->maxalloctime[k] = km->maxalloctime[k];
+    }
+    release(&km->lock);
+  }
+
+  acquire(&zpool.lock);
+  st->zeroedpages = zpool.nfree;
+  release(&zpool.lock);
+
+  st->freepages += st->cachedpages + st->zeroedpages;
+}
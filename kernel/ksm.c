@@ -0,0 +1,346 @@
+// Same-page merging: sharing identical pages of user memory.
+//
+// When a CPU has nothing to run, the scheduler calls
+// ksmscan(), which moves a hand through the page tables of
+// processes that aren't running, hashing each private user
+// page it passes. A page whose contents match a merged page
+// is remapped to the merged page, and its own page is freed.
+// Otherwise the page is remembered as a candidate, in a
+// table indexed by its hash; when a later page matches a
+// candidate, the candidate becomes a merged page and both
+// are mapped to it.
+//
+// Merged pages are mapped copy-on-write (read-only if they
+// were read-only), so that uvmcow() gives a process its own
+// copy again when it writes one. They are never written, so
+// the stable table can keep them hashed by their contents.
+// It holds a reference to each, and drops pages that it
+// holds the only reference to.
+//
+// Candidates are not pinned: they are named by process and
+// address, and rechecked, and compared byte by byte, before
+// they are merged.
+//
+// ksmscan() changes the page tables of other processes, so
+// it follows the same rules as reclaim() (swap.c): it only
+// touches processes that are sleeping or runnable and not
+// in the middle of changing their own page tables, while
+// holding their p->lock. It holds two processes' locks when
+// it merges a page with a candidate of another process;
+// nothing else holds two p->locks at once, and only one CPU
+// scans at a time, so the order doesn't matter.
+//
+// The scan rate, in pages per clock tick, is set at run time
+// with the ksm() system call; 0 (the default) turns scanning
+// off.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "memstat.h"
+
+#define NBUCKET 127   // stable table hash chains
+#define NCAND 512     // candidate table entries
+#define BATCH 32      // most pages one ksmscan() call scans
+
+extern struct proc proc[NPROC];
+
+struct kpage {
+  uint64 hash;
+  char *pa;
+  struct kpage *next;  // hash chain
+};
+
+struct cand {
+  uint64 hash;
+  int pid;             // 0 if empty
+  int slot;            // index in proc[]
+  uint64 va;
+};
+
+struct {
+  struct spinlock lock;
+  struct kmem_cache *cache;
+  struct kpage *bucket[NBUCKET];
+  int npages;          // merged pages
+  int rate;            // pages to scan per tick; 0 is off
+  int budget;          // pages left to scan this tick
+  uint tick;
+  int scanning;
+
+  // only the scanning CPU uses these.
+  struct cand cand[NCAND];
+  int hand;            // scanning proc[hand] at va
+  uint64 va;
+  uint64 nscan;
+  uint64 nmerge;
+} ksm;
+
+void
+ksminit(void)
+{
+  initlock(&ksm.lock, "ksm");
+  ksm.cache = kmem_cache_create("ksm", sizeof(struct kpage));
+}
+
+static uint64
+hashpage(char *pa)
+{
+  uint64 h = 14695981039346656037UL;
+
+  for(uint64 *w = (uint64*)pa; w < (uint64*)(pa + PGSIZE); w++)
+    h = (h ^ *w) * 1099511628211UL;
+  return h;
+}
+
+// Drop merged pages in chain *pp that no one maps any more.
+// Caller must hold ksm.lock.
+static void
+prunechain(struct kpage **pp)
+{
+  struct kpage *k;
+
+  while((k = *pp) != 0){
+    if(krefcnt(k->pa) > 1){
+      pp = &k->next;
+      continue;
+    }
+    *pp = k->next;
+    kfree(k->pa);
+    kmem_cache_free(ksm.cache, k);
+    ksm.npages--;
+  }
+}
+
+static void
+prune(void)
+{
+  acquire(&ksm.lock);
+  for(int i = 0; i < NBUCKET; i++)
+    prunechain(&ksm.bucket[i]);
+  release(&ksm.lock);
+}
+
+// The merged page with the same contents as the page at
+// pa, whose hash is h, or 0. Takes a reference to it for
+// the caller, before prune() can free it.
+static char*
+lookup(uint64 h, char *pa)
+{
+  struct kpage *k;
+  char *kpa = 0;
+
+  acquire(&ksm.lock);
+  prunechain(&ksm.bucket[h % NBUCKET]);
+  for(k = ksm.bucket[h % NBUCKET]; k; k = k->next){
+    if(k->hash == h && memcmp(k->pa, pa, PGSIZE) == 0){
+      kpa = k->pa;
+      kref(kpa);
+      break;
+    }
+  }
+  release(&ksm.lock);
+  return kpa;
+}
+
+// Make p's pte for va map the merged page kpa instead of its
+// own page, which it must hold the only reference to. The
+// caller's reference to kpa becomes the pte's.
+static void
+merge(struct proc *p, uint64 va, pte_t *pte, char *kpa)
+{
+  char *pa = (char*)PTE2PA(*pte);
+  uint flags = PTE_FLAGS(*pte);
+
+  if(flags & PTE_W)
+    flags = (flags & ~PTE_W) | PTE_COW;
+  *pte = PA2PTE(kpa) | flags;
+  tlbflush(p, va);
+  kfree(pa);
+  acquire(&ksm.lock);
+  ksm.nmerge++;
+  release(&ksm.lock);
+}
+
+// May ksmscan() change p's page table?
+// Caller must hold p->lock.
+static int
+mergeable(struct proc *p)
+{
+  return (p->state == SLEEPING || p->state == RUNNABLE) && p->vmbusy == 0;
+}
+
+// If candidate c still maps a private page with the same
+// contents as the page at pa, whose hash is h, make it a
+// merged page, and return it with a reference for the
+// caller, as lookup() does. Caller must hold p->lock.
+static char*
+promote(struct cand *c, struct proc *p, char *pa, uint64 h)
+{
+  struct proc *q = &proc[c->slot];
+  struct kpage *k;
+  pte_t *pte;
+  char *qpa = 0;
+  int level = 0;
+
+  if(q != p)
+    acquire(&q->lock);
+  if(q->pid != c->pid || !mergeable(q))
+    goto out;
+  pte = walklevel(q->pagetable, c->va, 0, &level);
+  if(pte == 0 || level != 0 || (*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+    goto out;
+  qpa = (char*)PTE2PA(*pte);
+  if(qpa == pa || krefcnt(qpa) != 1 || memcmp(qpa, pa, PGSIZE) != 0 ||
+     (k = kmem_cache_alloc(ksm.cache)) == 0){
+    qpa = 0;
+    goto out;
+  }
+
+  if(*pte & PTE_W){
+    *pte = (*pte & ~PTE_W) | PTE_COW;
+    tlbflush(q, c->va);
+  }
+  kref(qpa);  // the merged page list's
+  kref(qpa);  // the caller's
+  k->hash = h;
+  k->pa = qpa;
+  acquire(&ksm.lock);
+  k->next = ksm.bucket[h % NBUCKET];
+  ksm.bucket[h % NBUCKET] = k;
+  ksm.npages++;
+  ksm.nmerge++;
+  release(&ksm.lock);
+
+ out:
+  if(q != p)
+    release(&q->lock);
+  return qpa;
+}
+
+// Look at p's page at va, whose PTE is pte.
+// Caller must hold p->lock.
+static void
+scan(struct proc *p, uint64 va, pte_t *pte)
+{
+  char *pa = (char*)PTE2PA(*pte), *kpa;
+  struct cand *c;
+  uint64 h;
+
+  ksm.nscan++;
+  if(krefcnt(pa) != 1)
+    return;  // shared already
+  h = hashpage(pa);
+  if((kpa = lookup(h, pa)) != 0){
+    merge(p, va, pte, kpa);
+    return;
+  }
+
+  c = &ksm.cand[h % NCAND];
+  if(c->pid != 0 && c->hash == h && (kpa = promote(c, p, pa, h)) != 0){
+    merge(p, va, pte, kpa);
+    c->pid = 0;
+    return;
+  }
+  c->hash = h;
+  c->pid = p->pid;
+  c->slot = p - proc;
+  c->va = va;
+}
+
+// Called by a CPU's scheduler when it has nothing to run:
+// scan a batch of user pages, within this tick's budget.
+// Returns the number of pages scanned.
+int
+ksmscan(void)
+{
+  struct proc *p;
+  pte_t *pte;
+  int n, scanned = 0, visits = 0;
+
+  if(ksm.rate == 0)  // racy peek, just a hint
+    return 0;
+
+  acquire(&ksm.lock);
+  if(ksm.tick != ticks){
+    ksm.tick = ticks;
+    ksm.budget = ksm.rate;
+  }
+  n = ksm.budget < BATCH ? ksm.budget : BATCH;
+  if(ksm.scanning || n == 0){
+    release(&ksm.lock);
+    return 0;
+  }
+  ksm.budget -= n;
+  ksm.scanning = 1;
+  release(&ksm.lock);
+
+  while(n > 0 && visits < NPROC){
+    p = &proc[ksm.hand];
+    acquire(&p->lock);
+    if(mergeable(p) && (pte = uvmnext(p->pagetable, &ksm.va)) != 0){
+      scan(p, ksm.va, pte);
+      release(&p->lock);
+      ksm.va += PGSIZE;
+      n--;
+      scanned++;
+      continue;
+    }
+    release(&p->lock);
+    ksm.va = 0;
+    visits++;
+    if(++ksm.hand == NPROC){
+      ksm.hand = 0;
+      prune();
+    }
+  }
+
+  acquire(&ksm.lock);
+  ksm.scanning = 0;
+  release(&ksm.lock);
+  return scanned;
+}
+
+// Set the scan rate to rate pages per tick, unless rate
+// is negative. Returns the old rate.
+int
+ksmrate(int rate)
+{
+  int old;
+
+  acquire(&ksm.lock);
+  old = ksm.rate;
+  if(rate >= 0)
+    ksm.rate = rate;
+  release(&ksm.lock);
+  if(rate == 0)
+    prune();
+  return old;
+}
+
+void
+ksmstat(struct memstat *st)
+{
+  struct kpage *k;
+  uint64 saved = 0;
+  int n;
+
+  acquire(&ksm.lock);
+  for(int i = 0; i < NBUCKET; i++){
+    for(k = ksm.bucket[i]; k; k = k->next){
+      // one reference is the table's, and one mapping
+      // would need the page anyway.
+      if((n = krefcnt(k->pa)) > 2)
+        saved += n - 2;
+    }
+  }
+  st->ksmpages = ksm.npages;
+  st->ksmsaved = saved * PGSIZE;
+  release(&ksm.lock);
+  st->ksmscanned = ksm.nscan;
+  st->ksmmerged = ksm.nmerge;
+}
@@ -17,17 +17,26 @@ main()
     printf("xv6 kernel is booting\n");
     printf("\n");
     kinit();         // physical page allocator
+    slabinit();      // small object allocator
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
+    asidinit();      // address space IDs
     procinit();      // process table
+    vmainit();       // address space regions
     trapinit();      // trap vectors
+    wheelinit();     // timer wheels
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode table
     fileinit();      // file table
-    virtio_disk_init(); // emulated hard disk
+    pipeinit();      // pipe buffers
+    pcacheinit();    // page cache for mapped files
+    execinit();      // cache of recently run programs
+    virtio_disk_init(0); // emulated hard disk
+    swapinit();      // swap disk, if there is one
+    ksminit();       // same-page merging
     userinit();      // first user process
     __sync_synchronize();
     started = 1;
@@ -0,0 +1,31 @@
+// Physical memory statistics, filled in by the memstat() system call.
+
+#define NORDER 10  // buddy block orders: 0 (4 KiB) .. 9 (2 MiB)
+
+struct memstat {
+  uint64 freepages;              // free pages, including per-CPU caches
+  uint64 cachedpages;            // free pages held in per-CPU caches
+  uint64 zeroedpages;            // free pages zeroed ahead of time
+  uint64 megapages;              // user megapages mapped, new or collapsed
+  uint64 swapslots;              // pages the swap disk holds
+  uint64 swapused;               // of those, in use
+  uint64 swapouts;               // pages paged out
+  uint64 swapins;                // pages paged back in
+  uint64 zeropages;              // paged-out pages of zeros, which take no space
+  uint64 zrampages;              // paged-out pages held compressed in memory
+  uint64 zrambytes;              // their compressed size
+  uint64 zrampool;               // pages holding compressed data
+  uint64 zramins;                // page faults that decompressed a page
+  uint64 zramintime;             // their total time (in time CSR ticks)
+  uint64 diskins;                // page faults that read the swap disk
+  uint64 diskintime;             // their total time
+  uint64 ksmscanned;             // pages the same-page merger has looked at
+  uint64 ksmmerged;              // pages it has merged
+  uint64 ksmpages;               // merged pages
+  uint64 ksmsaved;               // bytes of memory merging saves
+  uint64 nfree[NORDER];          // free buddy blocks of each order
+  uint64 nalloc[NORDER];         // successful allocations of each order
+  uint64 nfail[NORDER];          // failed allocations of each order
+  uint64 alloctime[NORDER];      // total time (in time CSR ticks) spent allocating
+  uint64 maxalloctime[NORDER];   // slowest single allocation
+};
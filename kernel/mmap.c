@@ -0,0 +1,199 @@
+// Memory-mapped files.
+//
+// mmap() adds a region to the process's address space
+// (vma.c), just below the trapframe and below any earlier
+// mappings; pages are read in by mmapfault() when first
+// touched, through the page cache (pcache.c), so that
+// every process mapping a page of a file shares the same
+// physical page.
+//
+// MAP_PRIVATE mappings map the cached page copy-on-write.
+// MAP_SHARED mappings are mapped read-only until the first
+// write, so that a page is writable in a process's page
+// table only if the process may have written it: those
+// are the pages munmap() writes back to the file.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "fcntl.h"
+
+// Map len bytes of f, starting at offset off, into the
+// current process. addr is only a hint, and is ignored.
+// Returns the address of the mapping, or -1.
+uint64
+mmap(uint64 addr, uint64 len, int prot, int flags, struct file *f, uint64 off)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 base;
+
+  if(len == 0 || off % PGSIZE != 0 || off > MAXFILE*BSIZE)
+    return -1;
+  if(f->type != FD_INODE || !f->readable)
+    return -1;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  if(flags == MAP_SHARED && (prot & PROT_WRITE) && !f->writable)
+    return -1;
+
+  // just below the lowest region above the heap.
+  len = PGROUNDUP(len);
+  base = TRAPFRAME;
+  if((v = vmanext(&p->vmas, PGROUNDUP(p->sz))) != 0)
+    base = v->start;
+  if(len > base || base - len < PGROUNDUP(p->sz))
+    return -1;
+  if((v = vmaadd(&p->vmas, base - len, base, prot, VMA_FILE)) == 0)
+    return -1;
+  v->flags = flags;
+  v->f = filedup(f);
+  v->off = off;
+  return v->start;
+}
+
+// Handle a page fault at va in the current process's
+// mapping v of a file: the first access to a page, or the
+// first write to a page of a MAP_SHARED mapping.
+// Returns 0 if the page is now mapped and allows the access,
+// -1 if the access is not allowed or memory is exhausted.
+int
+mmapfault(struct vma *v, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  struct inode *ip;
+  pte_t *pte;
+  uint64 off;
+  char *pa;
+  int perm, locked;
+
+  va = PGROUNDDOWN(va);
+  if((v->prot & PROT_READ) == 0 || (write && (v->prot & PROT_WRITE) == 0))
+    return -1;
+
+  pte = walk(p->pagetable, va, 0);
+  if(pte && (*pte & PTE_V)){
+    if(v->flags != MAP_SHARED || !write)
+      return -1;
+    *pte |= PTE_W;
+    return 0;
+  }
+
+  ip = v->f->ip;
+  off = v->off + (va - v->start);
+
+  // the process may already hold ip's lock, if read() or
+  // write() is copying between the file and this mapping.
+  // it holds no other inode's lock: they fault mappings in
+  // first, with uvmprefault().
+  locked = holdingsleep(&ip->lock);
+  if(!locked)
+    ilock(ip);
+  if((pa = pcache_get(ip, off)) == 0){
+    if((pa = ualloc(1)) == 0)
+      goto bad;
+    if((off < MAXFILE*BSIZE && readi(ip, 0, (uint64)pa, off, PGSIZE) < 0) ||
+       pcache_add(ip, off, pa) != 0){
+      kfree(pa);
+      goto bad;
+    }
+  }
+  if(!locked)
+    iunlock(ip);
+
+  perm = PTE_U | PTE_R;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+  if(v->flags == MAP_SHARED && write)
+    perm |= PTE_W;
+  else if(v->flags == MAP_PRIVATE && (v->prot & PROT_WRITE))
+    perm |= PTE_COW;
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)pa, perm) != 0){
+    kfree(pa);
+    return -1;
+  }
+  if(write && (perm & PTE_COW))
+    return uvmcow(p->pagetable, va);
+  return 0;
+
+ bad:
+  if(!locked)
+    iunlock(ip);
+  return -1;
+}
+
+// Write the mapped page at pa back to ip at off, in
+// transactions small enough for the log. Does not
+// extend the file.
+static void
+writeback(struct inode *ip, uint64 off, char *pa)
+{
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  uint i, n;
+
+  for(i = 0; i < PGSIZE; i += n){
+    n = PGSIZE - i;
+    if(n > max)
+      n = max;
+    begin_op();
+    ilock(ip);
+    if(off + i >= ip->size){
+      iunlock(ip);
+      end_op();
+      break;
+    }
+    if(off + i + n > ip->size)
+      n = ip->size - (off + i);
+    writei(ip, 0, (uint64)pa + i, off + i, n);
+    iunlock(ip);
+    end_op();
+  }
+}
+
+// Unmap [start, end) of p's mapping v, writing back shared
+// pages that p may have written. vmaremove() has prepared
+// p's page table, so this can't run out of memory.
+void
+mmapunmap(struct proc *p, struct vma *v, uint64 start, uint64 end)
+{
+  struct inode *ip = v->f->ip;
+  pte_t *pte;
+  uint64 a;
+
+  uvmbegin();
+  if(v->flags == MAP_SHARED){
+    for(a = start; a < end; a += PGSIZE){
+      pte = walk(p->pagetable, a, 0);
+      if(pte && (*pte & PTE_V) && (*pte & PTE_W))
+        writeback(ip, v->off + (a - v->start), (char*)PTE2PA(*pte));
+    }
+  }
+  uvmunmap(p->pagetable, start, (end - start) / PGSIZE, 1);
+  uvmend();
+  for(a = start; a < end; a += PGSIZE)
+    pcache_put(ip, v->off + (a - v->start));
+}
+
+// Unmap len bytes at addr from the current process. The
+// range must lie within one mapping.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+
+  if(addr % PGSIZE != 0 || len == 0)
+    return -1;
+  len = PGROUNDUP(len);
+  if((v = vmalookup(&p->vmas, addr)) == 0 || v->type != VMA_FILE ||
+     addr + len < addr || addr + len > v->end)
+    return -1;
+  return vmaremove(p, addr, addr + len);
+}
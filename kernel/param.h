@@ -1,7 +1,17 @@
+#ifndef NPROC
 #define NPROC        64  // maximum number of processes
+#endif
 #define NCPU          8  // maximum number of CPUs
+#define TIMEBASE 10000000  // time CSR cycles per second, in qemu
+#define TICKCYCLES (TIMEBASE/10)  // time CSR cycles per clock tick
+#define NPRIO         4  // scheduling priority levels
+#define DEFWEIGHT  1024  // default fair-share weight (see setweight())
+#define MAXWEIGHT 65536  // maximum fair-share weight
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
+#define NVMA         64  // address space regions per process
+#define NTEXT         8  // recently run programs whose text stays cached
+#define NSWAP      8192  // maximum swap slots (pages) used on the swap disk
+#define NZRAM      8192  // maximum pages held compressed in memory
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
@@ -0,0 +1,170 @@
+// Page cache: physical pages holding the contents of
+// mapped files and of program text, so that processes
+// mapping the same part of a file, or running the same
+// program, share memory (see mmap.c and exec.c).
+//
+// A cached page is named by its in-memory inode and its
+// page-aligned offset in the file. The cache holds one
+// reference to each page, and each mapping of the page
+// holds another. munmap() drops pages that no mapping uses
+// any more, and iput() drops any that are left when the
+// inode's last reference goes away, so that the inode
+// pointer can't be reused while it names cached pages.
+//
+// Pages are added with the inode locked, so two processes
+// faulting on the same page don't both read it in, and
+// readi() and writei() use the cached copy of a page when
+// there is one, so file reads and writes stay coherent
+// with mappings.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "defs.h"
+#include "fs.h"
+#include "file.h"
+
+#define NBUCKET 61
+
+struct cpage {
+  struct inode *ip;
+  uint64 off;
+  char *pa;
+  struct cpage *next;  // hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct kmem_cache *cache;
+  struct cpage *bucket[NBUCKET];
+} pcache;
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+  pcache.cache = kmem_cache_create("pcache", sizeof(struct cpage));
+}
+
+// Return the link that points to ip's page at off in its
+// hash chain, or to the end of the chain if the page isn't
+// cached. Caller must hold pcache.lock.
+static struct cpage**
+lookup(struct inode *ip, uint64 off)
+{
+  struct cpage **pp;
+
+  pp = &pcache.bucket[((uint64)ip / sizeof(*ip) + off / PGSIZE) % NBUCKET];
+  for(; *pp; pp = &(*pp)->next)
+    if((*pp)->ip == ip && (*pp)->off == off)
+      break;
+  return pp;
+}
+
+// Return the cached page holding ip's data at off, with a
+// reference that the caller must drop with kfree(), or 0
+// if that page isn't cached.
+char*
+pcache_get(struct inode *ip, uint64 off)
+{
+  struct cpage *c;
+  char *pa = 0;
+
+  acquire(&pcache.lock);
+  if((c = *lookup(ip, PGROUNDDOWN(off))) != 0){
+    pa = c->pa;
+    kref(pa);
+  }
+  release(&pcache.lock);
+  return pa;
+}
+
+// Cache pa as ip's page at off, which must not be cached
+// already. The cache takes its own reference to pa.
+// Caller must hold ip->lock.
+// Returns 0 on success, -1 if out of memory.
+int
+pcache_add(struct inode *ip, uint64 off, char *pa)
+{
+  struct cpage *c, **pp;
+
+  if((c = kmem_cache_alloc(pcache.cache)) == 0)
+    return -1;
+  c->ip = ip;
+  c->off = off;
+  c->pa = pa;
+  c->next = 0;
+  kref(pa);
+
+  acquire(&pcache.lock);
+  pp = lookup(ip, off);
+  if(*pp)
+    panic("pcache_add");
+  *pp = c;
+  ip->ncached++;
+  release(&pcache.lock);
+  return 0;
+}
+
+// Copy n bytes at src into ip's cached page at off, if
+// there is one, so that mappings see data written with
+// write(). The bytes must not cross a page boundary.
+void
+pcache_write(struct inode *ip, uint64 off, void *src, uint n)
+{
+  char *pa;
+
+  if((pa = pcache_get(ip, off)) == 0)
+    return;
+  memmove(pa + off % PGSIZE, src, n);
+  kfree(pa);
+}
+
+// Drop ip's page at off from the cache if no mapping
+// uses it any more.
+void
+pcache_put(struct inode *ip, uint64 off)
+{
+  struct cpage *c, **pp;
+
+  acquire(&pcache.lock);
+  pp = lookup(ip, PGROUNDDOWN(off));
+  c = *pp;
+  if(c == 0 || krefcnt(c->pa) > 1){
+    release(&pcache.lock);
+    return;
+  }
+  *pp = c->next;
+  ip->ncached--;
+  release(&pcache.lock);
+
+  kfree(c->pa);
+  kmem_cache_free(pcache.cache, c);
+}
+
+// Drop all of ip's cached pages. Called by iput() when
+// the last reference to ip goes away, so no process has
+// the file mapped, or later if ikeep() kept them.
+void
+pcache_purge(struct inode *ip)
+{
+  struct cpage *c, **pp;
+
+  acquire(&pcache.lock);
+  for(int i = 0; i < NBUCKET && ip->ncached > 0; i++){
+    pp = &pcache.bucket[i];
+    while((c = *pp) != 0){
+      if(c->ip != ip){
+        pp = &c->next;
+        continue;
+      }
+      *pp = c->next;
+      ip->ncached--;
+      kfree(c->pa);
+      kmem_cache_free(pcache.cache, c);
+    }
+  }
+  release(&pcache.lock);
+}
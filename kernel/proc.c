@@ -5,6 +5,9 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "spawn.h"
+#include "fcntl.h"
+#include "cpustat.h"
 
 struct cpu cpus[NCPU];
 
@@ -17,6 +20,8 @@ struct spinlock pid_lock;
 
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static void runnable(struct proc *p);
+static void kick(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
 
@@ -26,6 +31,64 @@ extern char trampoline[]; // trampoline.S
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
+// Run queues. Each CPU has a queue of RUNNABLE processes,
+// which it runs in turn. A process joins the queue of the
+// CPU it last ran on (its creator's, at first) when it
+// becomes RUNNABLE. A CPU whose queue is empty steals the
+// first process from the longest queue instead. Picking the
+// next process to run costs the same however many processes
+// there are, and CPUs share no locks unless one runs dry.
+//
+// Each queue is a multi-level feedback queue: it has NPRIO
+// levels, and a CPU runs the processes on the highest level
+// first. A process starts at its base level (see
+// setpriority()), and moves down a level each time it runs
+// for a whole quantum of its level; lower levels have longer
+// quanta. So processes that mostly wait for I/O stay on
+// high levels and get the CPU soon after they wake, while
+// CPU-bound ones sink. Every BOOST ticks, every process goes
+// back to its base level, so that none starves.
+//
+// p->lock protects a queued process's state, and the queue's
+// lock its link and level. A process's lock is taken before
+// a queue's; scheduler() takes a process off its queue before
+// locking it.
+//
+// A kernel built with make SCHED=cfs schedules with cfs.c's
+// fair-share tree instead.
+#define BOOST 50  // ticks between boosts
+
+#ifndef CFS
+static int quantum[NPRIO] = { 1, 2, 4, 8 };  // ticks
+
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NPRIO];
+  struct proc *tail[NPRIO];
+  int n;       // processes on all levels
+  uint boost;  // ticks/BOOST when last boosted
+} runq[NCPU];
+#endif
+
+// Sleep queues. A sleeping process is on the queue its
+// channel hashes to, so that wakeup() looks only at the
+// processes that might be sleeping on its channel. The
+// process takes itself off when it wakes up. The lock passed
+// to sleep() is taken before a sleep queue's lock, and that
+// before p->lock.
+#define NSLEEPQ 61
+
+struct sleepq {
+  struct spinlock lock;
+  struct proc *head;
+} sleepq[NSLEEPQ];
+
+static struct sleepq*
+sleepqueue(void *chan)
+{
+  return &sleepq[((uint64)chan >> 3) % NSLEEPQ];
+}
+
 // Allocate a page for each process's kernel stack.
 // Map it high in memory, followed by an invalid
 // guard page.
@@ -51,6 +114,14 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+#ifdef CFS
+  cfsinit();
+#else
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+#endif
+  for(int i = 0; i < NSLEEPQ; i++)
+    initlock(&sleepq[i].lock, "sleepq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->state = UNUSED;
@@ -124,6 +195,13 @@ allocproc(void)
 found:
   p->pid = allocpid();
   p->state = USED;
+  p->cpu = cpuid();
+  p->prio = p->nice = p->used = 0;
+  p->boost = ticks / BOOST;
+  p->vruntime = 0;
+  p->weight = DEFWEIGHT;
+  p->asid = 0;
+  p->winok = 0;
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -159,7 +237,7 @@ freeproc(struct proc *p)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
   if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
+    proc_freepagetable(p->pagetable);
   p->pagetable = 0;
   p->sz = 0;
   p->pid = 0;
@@ -189,7 +267,7 @@ proc_pagetable(struct proc *p)
   // to/from user space, so not PTE_U.
   if(mappages(pagetable, TRAMPOLINE, PGSIZE,
               (uint64)trampoline, PTE_R | PTE_X) < 0){
-    uvmfree(pagetable, 0);
+    uvmfree(pagetable);
     return 0;
   }
 
@@ -198,7 +276,7 @@ proc_pagetable(struct proc *p)
   if(mappages(pagetable, TRAPFRAME, PGSIZE,
               (uint64)(p->trapframe), PTE_R | PTE_W) < 0){
     uvmunmap(pagetable, TRAMPOLINE, 1, 0);
-    uvmfree(pagetable, 0);
+    uvmfree(pagetable);
     return 0;
   }
 
@@ -208,11 +286,11 @@ proc_pagetable(struct proc *p)
 // Free a process's page table, and free the
 // physical memory it refers to.
 void
-proc_freepagetable(pagetable_t pagetable, uint64 sz)
+proc_freepagetable(pagetable_t pagetable)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
-  uvmfree(pagetable, sz);
+  uvmfree(pagetable);
 }
 
 // a user program that calls exec("/init")
@@ -240,6 +318,8 @@ userinit(void)
   // allocate one user page and copy initcode's instructions
   // and data into it.
   uvmfirst(p->pagetable, initcode, sizeof(initcode));
+  if(vmaadd(&p->vmas, 0, PGSIZE, PROT_READ|PROT_WRITE|PROT_EXEC, VMA_ANON) == 0)
+    panic("userinit");
   p->sz = PGSIZE;
 
   // prepare for the very first "return" from kernel to user.
@@ -249,7 +329,7 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  runnable(p);
 
   release(&p->lock);
 }
@@ -264,12 +344,15 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    if(sz + n < sz || vmagrow(p, sz, sz + n) != 0)
       return -1;
-    }
   } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    // program segments in the way go too: if the heap
+    // grows back, it must be zero, not the program.
+    if(sz + n > sz || vmaremove(p, PGROUNDUP(sz + n), PGROUNDUP(sz)) != 0)
+      return -1;
   }
+  sz += n;
   p->sz = sz;
   return 0;
 }
@@ -284,16 +367,24 @@ fork(void)
   struct proc *p = myproc();
 
   // Allocate process.
+ retry:
   if((np = allocproc()) == 0){
     return -1;
   }
 
-  // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  // Copy the regions of user memory from parent to child.
+  uvmbegin();
+  if(vmadup(p, np) < 0){
+    uvmend();
     freeproc(np);
     release(&np->lock);
+    // out of memory for page-table pages. reclaim() can't
+    // run while np->lock is held, so try it here.
+    if(reclaim() > 0)
+      goto retry;
     return -1;
   }
+  uvmend();
   np->sz = p->sz;
 
   // copy saved user registers.
@@ -307,8 +398,13 @@ fork(void)
     if(p->ofile[i])
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
+  if(p->exe)
+    np->exe = idup(p->exe);
 
   safestrcpy(np->name, p->name, sizeof(p->name));
+  np->prio = np->nice = p->nice;
+  np->vruntime = p->vruntime;
+  np->weight = p->weight;
 
   pid = np->pid;
 
@@ -319,12 +415,101 @@ fork(void)
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  runnable(np);
   release(&np->lock);
 
   return pid;
 }
 
+// Apply the n file descriptor actions in fa to np's open files.
+// Returns 0, or -1 if an action is invalid.
+static int
+spawnfds(struct proc *np, struct spawnfd *fa, int n)
+{
+  struct file *f;
+
+  for(int i = 0; i < n; i++){
+    if(fa[i].fd < 0 || fa[i].fd >= NOFILE)
+      return -1;
+    switch(fa[i].op){
+    case SPAWN_CLOSE:
+      if((f = np->ofile[fa[i].fd]) == 0)
+        return -1;
+      np->ofile[fa[i].fd] = 0;
+      fileclose(f);
+      break;
+    case SPAWN_DUP:
+      if(fa[i].fd2 < 0 || fa[i].fd2 >= NOFILE || np->ofile[fa[i].fd2] == 0)
+        return -1;
+      f = filedup(np->ofile[fa[i].fd2]);
+      if(np->ofile[fa[i].fd])
+        fileclose(np->ofile[fa[i].fd]);
+      np->ofile[fa[i].fd] = f;
+      break;
+    default:
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Create a new process running the program at path with
+// arguments argv, like fork() followed by exec() in the
+// child, but without copying the parent's memory. The child
+// gets copies of the parent's open files, changed by the n
+// actions in fa.
+// Returns the child's pid, or -1.
+int
+spawn(char *path, char **argv, struct spawnfd *fa, int n)
+{
+  int i, argc, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if((np = allocproc()) == 0)
+    return -1;
+  // reading the program sleeps. nothing else looks at np
+  // while it is USED, so it needn't stay locked.
+  release(&np->lock);
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+
+  for(i = 0; i < NOFILE; i++)
+    if(p->ofile[i])
+      np->ofile[i] = filedup(p->ofile[i]);
+  if(spawnfds(np, fa, n) < 0)
+    goto bad;
+  if((argc = execproc(np, path, argv)) < 0)
+    goto bad;
+  np->trapframe->a0 = argc;
+  np->cwd = idup(p->cwd);
+  np->prio = np->nice = p->nice;
+  np->vruntime = p->vruntime;
+  np->weight = p->weight;
+  pid = np->pid;
+
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  runnable(np);
+  release(&np->lock);
+
+  return pid;
+
+ bad:
+  for(i = 0; i < NOFILE; i++){
+    if(np->ofile[i]){
+      fileclose(np->ofile[i]);
+      np->ofile[i] = 0;
+    }
+  }
+  acquire(&np->lock);
+  freeproc(np);
+  release(&np->lock);
+  return -1;
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold wait_lock.
 void
@@ -351,6 +536,11 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  // Unmap mapped files, writing back dirty pages, and
+  // forget the regions of the address space. The pages
+  // go with the page table, in freeproc().
+  vmafree(p);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -362,8 +552,11 @@ exit(int status)
 
   begin_op();
   iput(p->cwd);
+  if(p->exe)
+    iput(p->exe);
   end_op();
   p->cwd = 0;
+  p->exe = 0;
 
   acquire(&wait_lock);
 
@@ -391,7 +584,7 @@ int
 wait(uint64 addr)
 {
   struct proc *pp;
-  int havekids, pid;
+  int havekids, pid, xstate;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
@@ -406,17 +599,17 @@ wait(uint64 addr)
 
         havekids = 1;
         if(pp->state == ZOMBIE){
-          // Found one.
+          // Found one. copyout() may fault and sleep to
+          // read the page in, so it must wait until the
+          // locks are released.
           pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
-            release(&pp->lock);
-            release(&wait_lock);
-            return -1;
-          }
+          xstate = pp->xstate;
           freeproc(pp);
           release(&pp->lock);
           release(&wait_lock);
+          if(addr != 0 && copyout(p->pagetable, addr, (char *)&xstate,
+                                  sizeof(xstate)) < 0)
+            return -1;
           return pid;
         }
         release(&pp->lock);
@@ -434,10 +627,249 @@ wait(uint64 addr)
   }
 }
 
+#ifdef CFS
+// Make p RUNNABLE, and put it in the fair-share tree,
+// charging it first for the time it ran if it was running.
+// Caller must hold p->lock.
+static void
+runnable(struct proc *p)
+{
+  if(p->state == RUNNING)
+    cfscharge(p);
+  p->state = RUNNABLE;
+  cfsenqueue(p);
+  kick(p);
+}
+
+// Choose a process for CPU id to run: the RUNNABLE one with
+// the least vruntime, from any CPU.
+// Returns 0 if there's nothing to run.
+static struct proc*
+pickproc(int id)
+{
+  return cfspick();
+}
+
+// Called on each clock interrupt while the current process
+// runs: give up the CPU if another process is now owed it.
+void
+schedtick(void)
+{
+  struct proc *p = myproc();
+  int preempt;
+
+  acquire(&p->lock);
+  preempt = cfspreempt(p);
+  release(&p->lock);
+  if(preempt)
+    yield();
+}
+#else
+// Put p at the end of its level of q.
+// Caller must hold q->lock.
+static void
+push(struct runq *q, struct proc *p)
+{
+  p->rqnext = 0;
+  if(q->tail[p->prio])
+    q->tail[p->prio]->rqnext = p;
+  else
+    q->head[p->prio] = p;
+  q->tail[p->prio] = p;
+}
+
+// Move the processes on q back to their base levels, if
+// they haven't been since the last BOOST ticks began.
+// Caller must hold q->lock.
+static void
+boost(struct runq *q)
+{
+  struct proc *p, *list = 0, **end = &list;
+  uint now = ticks / BOOST;
+
+  if(q->boost == now)
+    return;
+  q->boost = now;
+  for(int l = 0; l < NPRIO; l++){
+    if(q->head[l]){
+      *end = q->head[l];
+      end = &q->tail[l]->rqnext;
+    }
+    q->head[l] = q->tail[l] = 0;
+  }
+  while((p = list) != 0){
+    list = p->rqnext;
+    p->prio = p->nice;  // setpriority() may be changing it; a hint
+    p->used = 0;
+    p->boost = now;
+    push(q, p);
+  }
+}
+
+// Make p RUNNABLE, and put it on the run queue of the CPU
+// it last ran on.
+// Caller must hold p->lock.
+static void
+runnable(struct proc *p)
+{
+  struct runq *q = &runq[p->cpu];
+
+  if(p->boost != ticks / BOOST){
+    p->boost = ticks / BOOST;
+    p->prio = p->nice;
+    p->used = 0;
+  }
+  p->state = RUNNABLE;
+  acquire(&q->lock);
+  push(q, p);
+  q->n++;
+  release(&q->lock);
+  kick(p);
+}
+
+// Take the first process on the highest level of q off it,
+// or return 0 if q is empty.
+static struct proc*
+dequeue(struct runq *q)
+{
+  struct proc *p = 0;
+
+  acquire(&q->lock);
+  boost(q);
+  for(int l = 0; l < NPRIO && p == 0; l++){
+    if((p = q->head[l]) != 0){
+      q->head[l] = p->rqnext;
+      if(q->head[l] == 0)
+        q->tail[l] = 0;
+      q->n--;
+    }
+  }
+  release(&q->lock);
+  return p;
+}
+
+// Choose a process for CPU id to run: the first on the
+// highest level of its own run queue, or else of the
+// longest other queue.
+// Returns 0 if there's nothing to run.
+static struct proc*
+pickproc(int id)
+{
+  struct proc *p;
+  int i, n = 0, victim = -1;
+
+  if((p = dequeue(&runq[id])) != 0)
+    return p;
+  // the lengths are read without the locks; they're
+  // just a hint.
+  for(i = 1; i < NCPU; i++){
+    struct runq *q = &runq[(id + i) % NCPU];
+    if(q->n > n){
+      n = q->n;
+      victim = q - runq;
+    }
+  }
+  if(victim < 0)
+    return 0;
+  return dequeue(&runq[victim]);
+}
+
+// Called on each clock interrupt while the current process
+// runs: charge it for the tick. Once it has used its level's
+// quantum, it moves down a level and gives up the CPU. It
+// also gives up the CPU if a process on a higher level is
+// waiting for this CPU.
+void
+schedtick(void)
+{
+  struct proc *p = myproc();
+  struct runq *q;
+  int preempt = 0;
+
+  acquire(&p->lock);
+  if(++p->used >= quantum[p->prio]){
+    if(p->prio < NPRIO-1)
+      p->prio++;
+    p->used = 0;
+    preempt = 1;
+  }
+  q = &runq[p->cpu];
+  for(int l = 0; l < p->prio && !preempt; l++)
+    if(q->head[l])  // racy peek, just a hint
+      preempt = 1;
+  release(&p->lock);
+  if(preempt)
+    yield();
+}
+#endif
+
+// Wake CPU id with an IPI if it's idle. timervec turns the
+// IPI into a software interrupt, which ends the CPU's wfi.
+// Returns 1 if it was idle.
+static int
+wakecpu(int id)
+{
+  struct cpu *c = &cpus[id];
+
+  if(__sync_lock_test_and_set(&c->idle, 0) == 0)
+    return 0;
+  __sync_fetch_and_add(&c->nwake, 1);
+  *(volatile uint32*)CLINT_MSIP(id) = 1;
+  return 1;
+}
+
+// p has just been queued: make sure a CPU runs it soon. If
+// p's CPU is idle, wake it. If it's busy with another
+// process, wake some idle CPU, which will steal p.
+// Caller must hold p->lock.
+static void
+kick(struct proc *p)
+{
+  // queue p before looking at idle; see idle().
+  __sync_synchronize();
+  if(wakecpu(p->cpu))
+    return;
+  if(cpus[p->cpu].proc == p)
+    return;  // p is yielding; its CPU will choose again
+  if(p->cpu == cpuid() && mycpu()->proc == 0)
+    return;  // an interrupt in this CPU's scheduler, which will choose next
+  for(int i = 0; i < NCPU; i++)
+    if(wakecpu(i))
+      return;
+}
+
+// CPU id has nothing to run: wait in wfi until an interrupt,
+// such as wakecpu()'s IPI. It first sets c->idle and then
+// looks for a process once more, so that one queued in the
+// meantime isn't missed: either kick() sees c->idle, or the
+// second look sees the process. Interrupts are off, so that
+// one arriving before the wfi ends it at once.
+// Returns a process to run, if the second look found one.
+static struct proc*
+idle(int id)
+{
+  struct cpu *c = &cpus[id];
+  struct proc *p;
+  uint64 t0;
+
+  intr_off();
+  c->idle = 1;
+  __sync_synchronize();
+  if((p = pickproc(id)) == 0){
+    t0 = r_time();
+    wfi();
+    c->idletime += r_time() - t0;
+    c->nidle++;
+  }
+  c->idle = 0;
+  intr_on();
+  return p;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - choose a process to run, from its run queue.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -446,28 +878,46 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = cpuid();  // the scheduler never moves to another CPU
   
   c->proc = 0;
+  c->started = r_time();
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&p->lock);
+    if((p = pickproc(id)) == 0){
+      // nothing to run: zero a page for kalloc_zeroed(),
+      // or look for user pages to merge, or else sleep
+      // until there's something to do.
+      if(kzero() || ksmscan() || (p = idle(id)) == 0)
+        continue;
     }
+
+    acquire(&p->lock);
+    if(p->state == RUNNABLE) {
+      // Switch to chosen process.  It is the process's job
+      // to release its lock and then reacquire it
+      // before jumping back to us.
+      p->state = RUNNING;
+      p->cpu = id;
+      if(p->prio < p->nice)
+        p->prio = p->nice;
+      c->proc = p;
+      uvmwindow(p->pagetable);
+      p->start = r_time();
+      swtch(&c->context, &p->context);
+#ifdef CFS
+      // runnable() charged it if it's RUNNABLE again.
+      if(p->state != RUNNABLE)
+        cfscharge(p);
+#endif
+
+      // Process is done running for now.
+      // It should have changed its p->state before coming back.
+      c->proc = 0;
+    }
+    release(&p->lock);
   }
 }
 
@@ -477,11 +927,14 @@ scheduler(void)
 // kernel thread, not this CPU. It should
 // be proc->intena and proc->noff, but that would
 // break in the few places where a lock is held but
-// there's no process.
+// there's no process. Likewise sstatus.SUM, which is
+// set if a ucopy() was preempted, so that the kernel
+// can touch user memory only in ucopy().
 void
 sched(void)
 {
   int intena;
+  uint64 sum;
   struct proc *p = myproc();
 
   if(!holding(&p->lock))
@@ -494,7 +947,10 @@ sched(void)
     panic("sched interruptible");
 
   intena = mycpu()->intena;
+  sum = r_sstatus() & SSTATUS_SUM;
+  w_sstatus(r_sstatus() & ~SSTATUS_SUM);
   swtch(&p->context, &mycpu()->context);
+  w_sstatus(r_sstatus() | sum);
   mycpu()->intena = intena;
 }
 
@@ -504,7 +960,7 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  runnable(p);
   sched();
   release(&p->lock);
 }
@@ -536,28 +992,39 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct sleepq *q = sleepqueue(chan);
+  struct proc **pp;
   
-  // Must acquire p->lock in order to
+  // Must acquire q->lock and p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we hold q->lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks q->lock),
   // so it's okay to release lk.
 
+  acquire(&q->lock);
   acquire(&p->lock);  //DOC: sleeplock1
   release(lk);
 
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->sqnext = q->head;
+  q->head = p;
+  release(&q->lock);
 
   sched();
 
   // Tidy up.
   p->chan = 0;
+  release(&p->lock);
+  acquire(&q->lock);
+  for(pp = &q->head; *pp != p; pp = &(*pp)->sqnext)
+    ;
+  *pp = p->sqnext;
+  release(&q->lock);
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
@@ -566,17 +1033,20 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
+  struct sleepq *q = sleepqueue(chan);
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+  acquire(&q->lock);
+  for(p = q->head; p; p = p->sqnext) {
     if(p != myproc()){
       acquire(&p->lock);
       if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
+        runnable(p);
       }
       release(&p->lock);
     }
   }
+  release(&q->lock);
 }
 
 // Kill the process with the given pid.
@@ -593,7 +1063,7 @@ kill(int pid)
       p->killed = 1;
       if(p->state == SLEEPING){
         // Wake process from sleep().
-        p->state = RUNNABLE;
+        runnable(p);
       }
       release(&p->lock);
       return 0;
@@ -603,6 +1073,92 @@ kill(int pid)
   return -1;
 }
 
+// Set the base scheduling level of process pid, or of the
+// current process if pid is 0: the level it starts at, goes
+// back to at each boost, and never rises above. Level 0 is
+// the highest. A queued process's level belongs to its run
+// queue, so a new base takes effect when it next runs.
+// Returns the old base level, or -1.
+int
+setpriority(int pid, int nice)
+{
+  struct proc *p;
+  int old;
+
+  if(nice < 0 || nice >= NPRIO)
+    return -1;
+  if(pid == 0)
+    pid = myproc()->pid;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid){
+      old = p->nice;
+      p->nice = nice;
+      if(p->state != RUNNABLE){
+        p->prio = nice;
+        p->used = 0;
+      }
+      release(&p->lock);
+      return old;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// Set the fair-share weight of process pid, or of the
+// current process if pid is 0: its share of the CPUs is its
+// weight over the total weight of the RUNNABLE processes.
+// Only a kernel built with make SCHED=cfs has weights.
+// Returns the old weight, or -1.
+int
+setweight(int pid, int weight)
+{
+#ifdef CFS
+  struct proc *p;
+  int old;
+
+  if(weight < 1 || weight > MAXWEIGHT)
+    return -1;
+  if(pid == 0)
+    pid = myproc()->pid;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid){
+      old = p->weight;
+      p->weight = weight;
+      release(&p->lock);
+      return old;
+    }
+    release(&p->lock);
+  }
+  return -1;
+#else
+  return -1;
+#endif
+}
+
+// Fill in st[i] for each of the NCPU CPUs, and return how
+// many have started. The CPUs needn't start in order of
+// hartid, so a CPU that hasn't has st[i].started 0.
+int
+cpustats(struct cpustat *st)
+{
+  struct cpu *c;
+  int i, n = 0;
+
+  for(i = 0; i < NCPU; i++){
+    c = &cpus[i];
+    st[i].started = c->started;
+    st[i].idletime = c->idletime;
+    st[i].nidle = c->nidle;
+    st[i].nwake = c->nwake;
+    if(c->started)
+      n++;
+  }
+  return n;
+}
+
 void
 setkilled(struct proc *p)
 {
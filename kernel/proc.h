@@ -24,6 +24,13 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 asidgen;             // ASID generation the TLB was last flushed for
+  pagetable_t kpagetable;     // This CPU's kernel page table; see uvmwindow()
+  int idle;                   // Waiting in idle(), or about to; see wakecpu()
+  uint64 started;             // time CSR when it started scheduling
+  uint64 idletime;            // time CSR cycles spent in wfi
+  uint64 nidle;               // times it went idle
+  uint64 nwake;               // IPIs sent to wake it
 };
 
 extern struct cpu cpus[NCPU];
@@ -81,6 +88,32 @@ struct trapframe {
 
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+enum vmatype { VMA_ANON, VMA_EXEC, VMA_FILE };
+
+// a region of a process's address space, and what backs
+// its pages: zeros, the program file, or a mapped file.
+// fault() looks the region up to handle the first touch
+// of a page in it.
+struct vma {
+  uint64 start;        // page-aligned
+  uint64 end;          // page-aligned, above start
+  int prot;            // PROT_READ, PROT_WRITE, PROT_EXEC
+  enum vmatype type;
+  int flags;           // VMA_FILE: MAP_SHARED or MAP_PRIVATE
+  struct file *f;      // VMA_FILE: the mapped file
+  uint64 off;          // VMA_EXEC, VMA_FILE: file offset of start
+  uint64 filesz;       // VMA_EXEC: bytes from the file; the rest is zero
+  struct vma *left;    // tree links; see vma.c
+  struct vma *right;
+  int height;
+};
+
+// a process's regions, in a balanced tree ordered by address.
+struct vmatree {
+  struct vma *root;
+  int n;
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -91,6 +124,23 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int cpu;                     // CPU whose run queue it joins
+
+  // p->lock, or the run queue's lock while p is queued:
+  int prio;                    // Scheduling level; 0 is the highest
+  int used;                    // Ticks of the level's quantum used
+  uint boost;                  // ticks/BOOST when it was last boosted
+  int nice;                    // Base level; see setpriority()
+  uint64 vruntime;             // Weighted time run, in time CSR cycles; see cfs.c
+  int weight;                  // Share of the CPU; see setweight()
+  uint64 start;                // time CSR when it last started running
+
+  // the run queue's or sleep queue's lock protects these:
+  struct proc *rqnext;         // Next on the run queue
+  struct proc *rqleft;         // cfs.c's tree of RUNNABLE processes
+  struct proc *rqright;
+  int rqheight;
+  struct proc *sqnext;         // Next on the sleep queue
 
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
@@ -102,6 +152,12 @@ struct proc {
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
+  struct vmatree vmas;         // Regions of the address space
+  struct inode *exe;           // Program file, for demand paging
+  int vmbusy;                  // Using page table; keeps reclaim() away
+  uint64 asid;                 // ASID generation and number; see uvmasid()
+  uint64 tlbok;                // CPUs holding no stale TLB entries for it
+  uint64 winok;                // CPUs whose window holds no stale entries for it
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
 };
@@ -0,0 +1,233 @@
+// Slab allocator for small, fixed-size kernel objects.
+//
+// A cache hands out objects of one size. It carves pages
+// from kalloc() into slabs: each slab is one page, starting
+// with a struct slab header followed by as many objects as fit.
+// Free objects in a slab are linked through their first word.
+// A slab whose objects are all free goes back to kalloc(), so
+// the memory used by a cache follows the number of live objects.
+//
+// Each CPU has a magazine of free objects per cache, which it
+// uses without taking the cache lock. A CPU refills an empty
+// magazine from the slabs, and flushes half of a full one back,
+// under the cache lock.
+//
+// Interface:
+// * kmem_cache_create(name, size) makes a cache, at boot.
+// * kmem_cache_alloc(c) returns an object, or 0 if out of memory.
+//   The object's contents are undefined.
+// * kmem_cache_free(c, obj) returns an object to its cache.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NCACHE  8   // maximum number of caches
+#define MAGSIZE 16  // objects per per-CPU magazine
+
+// a free object.
+struct object {
+  struct object *next;
+};
+
+// header at the start of each slab page.
+struct slab {
+  struct slab *next;   // on one of the cache's slab lists
+  struct slab *prev;
+  struct object *freelist;
+  int inuse;           // objects handed out from this slab
+};
+
+struct magazine {
+  int n;
+  void *objs[MAGSIZE];
+};
+
+struct kmem_cache {
+  struct spinlock lock;
+  char *name;
+  uint size;            // object size, rounded up for alignment
+  int perslab;          // objects per slab
+
+  // slabs with at least one free object, and slabs with none.
+  struct slab partial;
+  struct slab full;
+
+  struct magazine mag[NCPU];
+};
+
+struct {
+  struct spinlock lock;
+  struct kmem_cache cache[NCACHE];
+  int n;
+} slabs;
+
+// objects start after the header, 16-byte aligned.
+#define SLABHDR ((sizeof(struct slab) + 15) & ~15)
+
+static void
+slab_push(struct slab *head, struct slab *s)
+{
+  s->next = head->next;
+  s->prev = head;
+  head->next->prev = s;
+  head->next = s;
+}
+
+static void
+slab_unlink(struct slab *s)
+{
+  s->prev->next = s->next;
+  s->next->prev = s->prev;
+}
+
+// Create a cache of objects of the given size.
+// Caches are never destroyed.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size)
+{
+  struct kmem_cache *c;
+
+  if(size < sizeof(struct object))
+    size = sizeof(struct object);
+  size = (size + 15) & ~15;
+  if(SLABHDR + size > PGSIZE)
+    panic("kmem_cache_create: object too big");
+
+  acquire(&slabs.lock);
+  if(slabs.n >= NCACHE)
+    panic("kmem_cache_create: too many caches");
+  c = &slabs.cache[slabs.n++];
+  release(&slabs.lock);
+
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->perslab = (PGSIZE - SLABHDR) / size;
+  c->partial.next = c->partial.prev = &c->partial;
+  c->full.next = c->full.prev = &c->full;
+  for(int i = 0; i < NCPU; i++)
+    c->mag[i].n = 0;
+  return c;
+}
+
+void
+slabinit(void)
+{
+  initlock(&slabs.lock, "slabs");
+}
+
+// Make a new slab for c, with all objects free.
+// Returns 0 if out of memory. Caller must hold c->lock.
+static struct slab*
+slab_grow(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *obj;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->inuse = 0;
+  s->freelist = 0;
+  for(int i = c->perslab - 1; i >= 0; i--){
+    obj = (char*)s + SLABHDR + i*c->size;
+    ((struct object*)obj)->next = s->freelist;
+    s->freelist = (struct object*)obj;
+  }
+  slab_push(&c->partial, s);
+  return s;
+}
+
+// Take up to n objects from c's slabs into objs[].
+// Returns how many were taken. Caller must hold c->lock.
+static int
+slab_take(struct kmem_cache *c, void **objs, int n)
+{
+  struct slab *s;
+  struct object *o;
+  int i;
+
+  for(i = 0; i < n; ){
+    s = c->partial.next;
+    if(s == &c->partial && (s = slab_grow(c)) == 0)
+      break;
+    while(i < n && s->freelist){
+      o = s->freelist;
+      s->freelist = o->next;
+      s->inuse++;
+      objs[i++] = o;
+    }
+    if(s->freelist == 0){
+      slab_unlink(s);
+      slab_push(&c->full, s);
+    }
+  }
+  return i;
+}
+
+// Return an object to its slab, and the slab to kalloc()
+// if it is now unused. Caller must hold c->lock.
+static void
+slab_put(struct kmem_cache *c, void *obj)
+{
+  struct slab *s = (struct slab*)PGROUNDDOWN((uint64)obj);
+  struct object *o = (struct object*)obj;
+
+  if(s->freelist == 0){
+    // was full.
+    slab_unlink(s);
+    slab_push(&c->partial, s);
+  }
+  o->next = s->freelist;
+  s->freelist = o;
+  if(--s->inuse == 0){
+    slab_unlink(s);
+    kfree(s);
+  }
+}
+
+// Allocate an object from cache c.
+// Returns 0 if the memory cannot be allocated.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct magazine *m;
+  void *obj = 0;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == 0){
+    acquire(&c->lock);
+    m->n = slab_take(c, m->objs, MAGSIZE/2);
+    release(&c->lock);
+  }
+  if(m->n > 0)
+    obj = m->objs[--m->n];
+  pop_off();
+  return obj;
+}
+
+// Return obj, which came from kmem_cache_alloc(c), to c.
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct magazine *m;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == MAGSIZE){
+    // magazine full: give the older half back to the slabs.
+    acquire(&c->lock);
+    for(int i = 0; i < MAGSIZE/2; i++)
+      slab_put(c, m->objs[i]);
+    release(&c->lock);
+    for(int i = MAGSIZE/2; i < MAGSIZE; i++)
+      m->objs[i - MAGSIZE/2] = m->objs[i];
+    m->n -= MAGSIZE/2;
+  }
+  m->objs[m->n++] = obj;
+  pop_off();
+}
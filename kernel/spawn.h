@@ -0,0 +1,15 @@
+// File descriptor actions for the spawn() system call,
+// applied in order to the child's copies of the parent's
+// open files. The list ends with a SPAWN_END action.
+
+#define SPAWN_MAX 16  // most actions in a list, including the end
+
+#define SPAWN_END   0
+#define SPAWN_CLOSE 1 // close fd
+#define SPAWN_DUP   2 // make fd refer to what fd2 does
+
+struct spawnfd {
+  int op;
+  int fd;
+  int fd2;
+};
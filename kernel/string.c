@@ -1,13 +1,35 @@
 #include "types.h"
+#include "riscv.h"
+#include "defs.h"
+
+// memset(), memcmp() and memmove() work a word at a time
+// where they can, and hand long runs to the vector versions
+// in vstring.S if the CPU has the vector extension.
+
+#define VMIN 64  // shortest run worth the vector versions' setup
+
+// set by start() if the CPU has the vector extension.
+int hasvector;
+
+// is p aligned to a word?
+#define ALIGNED(p) (((uint64)(p) & 7) == 0)
 
 void*
 memset(void *dst, int c, uint n)
 {
-  char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
-  }
+  char *d = (char *) dst;
+  uint64 w;
+
+  if(hasvector && n >= VMIN)
+    return vmemset(dst, c, n);
+
+  for(; n > 0 && !ALIGNED(d); n--)
+    *d++ = c;
+  w = (uchar)c * 0x0101010101010101UL;
+  for(; n >= 8; n -= 8, d += 8)
+    *(uint64*)d = w;
+  for(; n > 0; n--)
+    *d++ = c;
   return dst;
 }
 
@@ -16,8 +38,19 @@ memcmp(const void *v1, const void *v2, uint n)
 {
   const uchar *s1, *s2;
 
+  if(hasvector && n >= VMIN)
+    return vmemcmp(v1, v2, n);
+
   s1 = v1;
   s2 = v2;
+  if(((uint64)s1 & 7) == ((uint64)s2 & 7)){
+    for(; n > 0 && !ALIGNED(s1); n--, s1++, s2++)
+      if(*s1 != *s2)
+        return *s1 - *s2;
+    // skip equal words; the bytes find the difference.
+    for(; n >= 8 && *(uint64*)s1 == *(uint64*)s2; n -= 8)
+      s1 += 8, s2 += 8;
+  }
   while(n-- > 0){
     if(*s1 != *s2)
       return *s1 - *s2;
@@ -27,6 +60,55 @@ memcmp(const void *v1, const void *v2, uint n)
   return 0;
 }
 
+// copy n bytes forwards, a word at a time once d is aligned.
+// if s isn't aligned too, read aligned words and shift them
+// together; aligned words don't cross pages, so reading
+// a little past the end is harmless.
+static void
+copyfwd(char *d, const char *s, uint n)
+{
+  const uint64 *ws;
+  uint64 lo, hi;
+  int shift;
+
+  for(; n > 0 && !ALIGNED(d); n--)
+    *d++ = *s++;
+  if(n >= 8 && ALIGNED(s)){
+    for(; n >= 8; n -= 8, d += 8, s += 8)
+      *(uint64*)d = *(const uint64*)s;
+  } else if(n >= 8){
+    shift = ((uint64)s & 7) * 8;
+    ws = (const uint64*)((uint64)s & ~7L);
+    lo = *ws++;
+    for(; n >= 8; n -= 8, d += 8, s += 8){
+      hi = *ws++;
+      *(uint64*)d = lo >> shift | hi << (64 - shift);
+      lo = hi;
+    }
+  }
+  for(; n > 0; n--)
+    *d++ = *s++;
+}
+
+// copy n bytes backwards, from the ends of d and s down.
+static void
+copybwd(char *d, const char *s, uint n)
+{
+  d += n;
+  s += n;
+  if(((uint64)d & 7) == ((uint64)s & 7)){
+    for(; n > 0 && !ALIGNED(d); n--)
+      *--d = *--s;
+    for(; n >= 8; n -= 8){
+      d -= 8;
+      s -= 8;
+      *(uint64*)d = *(const uint64*)s;
+    }
+  }
+  for(; n > 0; n--)
+    *--d = *--s;
+}
+
 void*
 memmove(void *dst, const void *src, uint n)
 {
@@ -35,17 +117,15 @@ memmove(void *dst, const void *src, uint n)
 
   if(n == 0)
     return dst;
+  if(hasvector && n >= VMIN)
+    return vmemmove(dst, src, n);
   
   s = src;
   d = dst;
-  if(s < d && s + n > d){
-    s += n;
-    d += n;
-    while(n-- > 0)
-      *--d = *--s;
-  } else
-    while(n-- > 0)
-      *d++ = *s++;
+  if(s < d && s + n > d)
+    copybwd(d, s, n);
+  else
+    copyfwd(d, s, n);
 
   return dst;
 }
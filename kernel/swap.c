@@ -0,0 +1,356 @@
+// Swapping: paging user memory out.
+//
+// When there's no free page for user memory, ualloc()
+// calls reclaim(), which runs a clock over the page tables
+// of the process that needs the memory and of those that
+// aren't running. A page whose accessed bit is set gets
+// the bit cleared and a second chance; the first page the
+// hand finds that hasn't been touched since is paged out,
+// and its PTE is made invalid, with PTE_SWAP set and a
+// slot number in place of the physical page number.
+// vmfault() calls swapin() to bring the page back when the
+// process next touches it.
+//
+// The slot number says where the page went:
+// * a page of zeros isn't kept at all; its slot is ZEROSLOT.
+// * otherwise the page is compressed into memory (zram.c),
+//   if it compresses well; its slot is ZSLOT plus the zram
+//   entry number.
+// * otherwise it is written to a slot below NSWAP of the
+//   swap disk (the second virtio disk), if there is one.
+//
+// Only private 4 KiB pages are paged out; pages that
+// several page tables share and megapages stay put.
+// fork() shares a paged-out page copy-on-write by sharing
+// its slot, so slots have reference counts.
+//
+// The disk write sleeps, so reclaim() can't hold the
+// victim's p->lock across it. It pins the page, clears its
+// dirty bit, writes it out, and then replaces the PTE with
+// the swap PTE only if the PTE hasn't changed meanwhile:
+// the hardware sets the accessed bit if the process uses
+// the page, and copyout() sets the dirty bit if the kernel
+// writes it. A process's own kernel code may keep pointers
+// to its PTEs across a sleep or a preemption, so reclaim()
+// leaves other processes alone while their vmbusy is set
+// (see uvmbegin() in vm.c).
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "defs.h"
+#include "memstat.h"
+
+#define SWAPDISK 1               // virtio disk number
+#define SECTORS (PGSIZE / 512)   // disk sectors per slot
+#define BATCH 16                 // pages reclaim() tries to page out
+
+#define ZSLOT NSWAP              // first slot of compressed pages
+#define ZEROSLOT (ZSLOT + NZRAM) // slot of all pages of zeros
+
+extern struct proc proc[NPROC];
+
+struct {
+  struct spinlock lock;
+  int nslot;             // 0 if there's no swap disk
+  int nused;
+  int next;              // where to look for a free slot
+  uchar ref[NSWAP];      // references to each slot; 0 if free
+  uint64 nzero;          // references to ZEROSLOT
+  uint64 nout;
+  uint64 nin;
+  uint64 nzramin;        // swapin()s from zram, and their time
+  uint64 zramintime;
+  uint64 ndiskin;        // swapin()s from the disk, and their time
+  uint64 diskintime;
+
+  // one reclaim() at a time moves the clock hand, which
+  // points at proc[hand] and virtual address va in it.
+  struct sleeplock reclaiming;
+  int hand;
+  uint64 va;
+} swap;
+
+void
+swapinit(void)
+{
+  uint64 n;
+
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.reclaiming, "reclaim");
+  zraminit();
+  n = virtio_disk_init(SWAPDISK) / SECTORS;
+  if(n > NSWAP)
+    n = NSWAP;
+  swap.nslot = n;
+}
+
+// Allocate a swap slot. Returns its number, or -1 if the
+// swap disk is full.
+static int
+slotalloc(void)
+{
+  int s;
+
+  acquire(&swap.lock);
+  for(int i = 0; i < swap.nslot; i++){
+    s = (swap.next + i) % swap.nslot;
+    if(swap.ref[s] == 0){
+      swap.ref[s] = 1;
+      swap.nused++;
+      swap.next = s + 1;
+      release(&swap.lock);
+      return s;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+// Add a reference to a swap slot, for fork().
+void
+swapdup(uint64 slot)
+{
+  if(slot >= ZSLOT && slot < ZEROSLOT){
+    zram_dup(slot - ZSLOT);
+    return;
+  }
+  acquire(&swap.lock);
+  if(slot == ZEROSLOT)
+    swap.nzero++;
+  else if(slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapdup");
+  else
+    swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+// Drop a reference to a swap slot, freeing it if that
+// was the last one.
+void
+swapfree(uint64 slot)
+{
+  if(slot >= ZSLOT && slot < ZEROSLOT){
+    zram_free(slot - ZSLOT);
+    return;
+  }
+  acquire(&swap.lock);
+  if(slot == ZEROSLOT){
+    swap.nzero--;
+  } else {
+    if(slot >= swap.nslot || swap.ref[slot] == 0)
+      panic("swapfree");
+    if(--swap.ref[slot] == 0)
+      swap.nused--;
+  }
+  release(&swap.lock);
+}
+
+// is the page at pa all zeros?
+static int
+zeroed(char *pa)
+{
+  for(uint64 *w = (uint64*)pa; w < (uint64*)(pa + PGSIZE); w++)
+    if(*w != 0)
+      return 0;
+  return 1;
+}
+
+// Move the clock hand through p's page table, from swap.va
+// up, to the next private user page that hasn't been used
+// since the hand last passed it, clearing accessed bits on
+// the way. Returns the page's PTE, with swap.va at its
+// address, or 0 if there's none.
+// Caller must hold p->lock.
+static pte_t*
+clockscan(struct proc *p)
+{
+  pte_t *pte;
+  int cleared = 0;
+
+  for(; (pte = uvmnext(p->pagetable, &swap.va)) != 0; swap.va += PGSIZE){
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      cleared = 1;
+    } else if(krefcnt((void*)PTE2PA(*pte)) == 1)
+      break;
+  }
+  // the hardware sets the accessed bit only when it loads
+  // a PTE into the TLB.
+  if(cleared)
+    tlbflush(p, MAXVA);
+  return pte;
+}
+
+// Can reclaim() change p's page table? It can always change
+// the page table of the process that called it, since that
+// process's kernel code is waiting for it to return.
+// Caller must hold p->lock.
+static int
+reclaimable(struct proc *p)
+{
+  if(p == myproc())
+    return 1;
+  return (p->state == SLEEPING || p->state == RUNNABLE) && p->vmbusy == 0;
+}
+
+// Page out the page at va in p, whose PTE is pte, unless
+// p uses the page or changes its mapping meanwhile.
+// Called with p->lock held; releases it.
+// Returns 1 if the page was paged out, 0 if p used it,
+// -1 if there's nowhere to put it.
+static int
+pageout(struct proc *p, uint64 va, pte_t *pte)
+{
+  int pid = p->pid, slot, r = 0;
+  pte_t old;
+  void *pa;
+
+  pa = (void*)PTE2PA(*pte);
+  *pte &= ~PTE_D;
+  tlbflush(p, va);  // so that a write sets the dirty bit again
+  old = *pte;
+  kref(pa);
+  release(&p->lock);
+
+  if(zeroed(pa)){
+    slot = ZEROSLOT;
+    acquire(&swap.lock);
+    swap.nzero++;
+    release(&swap.lock);
+  } else if((slot = zram_store(pa)) >= 0){
+    slot += ZSLOT;
+  } else if((slot = slotalloc()) >= 0){
+    virtio_disk_rwpage(SWAPDISK, (uint64)slot * SECTORS, pa, 1);
+  } else {
+    kfree(pa);
+    return -1;
+  }
+
+  acquire(&p->lock);
+  if(p->pid == pid && reclaimable(p) &&
+     (pte = walk(p->pagetable, va, 0)) != 0 && *pte == old){
+    *pte = SWAP2PTE(slot) | (PTE_FLAGS(old) & ~PTE_V) | PTE_SWAP;
+    tlbflush(p, va);
+    kfree(pa);
+    r = 1;
+  }
+  release(&p->lock);
+  kfree(pa);
+
+  if(r){
+    acquire(&swap.lock);
+    swap.nout++;
+    release(&swap.lock);
+  } else {
+    swapfree(slot);
+  }
+  return r;
+}
+
+// Free the cached text of programs no process is running,
+// or else page out a batch of user pages that haven't been
+// used recently. Returns the number of pages freed or paged
+// out, 0 if there's nowhere to put them or all memory is in
+// use.
+// May sleep, so the caller must not hold a spinlock.
+int
+reclaim(void)
+{
+  struct proc *p;
+  pte_t *pte;
+  int n = 0, r, visits = 0;
+  uint64 va;
+
+  // programs' text pages that exec() keeps cached go first.
+  if((n = droptext()) > 0)
+    return n;
+
+  acquiresleep(&swap.reclaiming);
+  // twice around: the first trip may only clear accessed bits.
+  while(n < BATCH && visits <= 2*NPROC){
+    p = &proc[swap.hand];
+    acquire(&p->lock);
+    if(reclaimable(p) && (pte = clockscan(p)) != 0){
+      va = swap.va;
+      swap.va += PGSIZE;
+      if((r = pageout(p, va, pte)) < 0)
+        break;
+      n += r;
+      continue;
+    }
+    release(&p->lock);
+    swap.hand = (swap.hand + 1) % NPROC;
+    swap.va = 0;
+    visits++;
+  }
+  zram_refill();
+  releasesleep(&swap.reclaiming);
+  return n;
+}
+
+// Bring back the page of the current process that pte says
+// is paged out.
+// Returns 0 on success, -1 if out of memory.
+int
+swapin(pte_t *pte)
+{
+  uint64 slot = PTE2SWAP(*pte), t0 = r_time();
+  char *mem;
+
+  if((mem = ualloc(slot == ZEROSLOT)) == 0)
+    return -1;
+  if(slot < ZSLOT)
+    virtio_disk_rwpage(SWAPDISK, slot * SECTORS, mem, 0);
+  else if(slot < ZEROSLOT)
+    zram_load(slot - ZSLOT, mem);
+  *pte = PA2PTE(mem) | (PTE_FLAGS(*pte) & ~PTE_SWAP) | PTE_V | PTE_A;
+  swapfree(slot);
+
+  acquire(&swap.lock);
+  swap.nin++;
+  if(slot < ZSLOT){
+    swap.ndiskin++;
+    swap.diskintime += r_time() - t0;
+  } else if(slot < ZEROSLOT){
+    swap.nzramin++;
+    swap.zramintime += r_time() - t0;
+  }
+  release(&swap.lock);
+  return 0;
+}
+
+// Allocate a page for user memory, zeroed if zero is set,
+// paging out other user memory if there's no free page.
+// May sleep, so the caller must not hold a spinlock.
+void*
+ualloc(int zero)
+{
+  void *pa;
+
+  while((pa = zero ? kalloc_zeroed() : kalloc()) == 0)
+    if(reclaim() == 0)
+      return 0;
+  return pa;
+}
+
+void
+swapstat(struct memstat *st)
+{
+  acquire(&swap.lock);
+  st->swapslots = swap.nslot;
+  st->swapused = swap.nused;
+  st->swapouts = swap.nout;
+  st->swapins = swap.nin;
+  st->zeropages = swap.nzero;
+  st->zramins = swap.nzramin;
+  st->zramintime = swap.zramintime;
+  st->diskins = swap.ndiskin;
+  st->diskintime = swap.diskintime;
+  release(&swap.lock);
+  zramstat(st);
+}
@@ -8,12 +8,12 @@
 #include "defs.h"
 
 // Fetch the uint64 at addr from the current process.
+// addr may be anywhere in the process's regions, not just
+// below p->sz; copyin() fails if it isn't.
 int
 fetchaddr(uint64 addr, uint64 *ip)
 {
   struct proc *p = myproc();
-  if(addr >= p->sz || addr+sizeof(uint64) > p->sz) // both tests needed, in case of overflow
-    return -1;
   if(copyin(p->pagetable, (char *)ip, addr, sizeof(*ip)) != 0)
     return -1;
   return 0;
@@ -101,6 +101,15 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
+extern uint64 sys_memstat(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_ksm(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_setpriority(void);
+extern uint64 sys_setweight(void);
+extern uint64 sys_cpustat(void);
+extern uint64 sys_nanosleep(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -126,6 +135,15 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_memstat] sys_memstat,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_ksm]     sys_ksm,
+[SYS_spawn]   sys_spawn,
+[SYS_setpriority] sys_setpriority,
+[SYS_setweight] sys_setweight,
+[SYS_cpustat] sys_cpustat,
+[SYS_nanosleep] sys_nanosleep,
 };
 
 void
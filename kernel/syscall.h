@@ -20,3 +20,12 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_memstat 22
+#define SYS_mmap   23
+#define SYS_munmap 24
+#define SYS_ksm    25
+#define SYS_spawn  26
+#define SYS_setpriority 27
+#define SYS_setweight 28
+#define SYS_cpustat 29
+#define SYS_nanosleep 30
@@ -5,6 +5,8 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "memstat.h"
+#include "cpustat.h"
 
 uint64
 sys_exit(void)
@@ -52,22 +54,22 @@ uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   argint(0, &n);
   if(n < 0)
     n = 0;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(killed(myproc())){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  return sleepuntil(r_time() + (uint64)n * TICKCYCLES);
+}
+
+// sleep for at least the given number of nanoseconds.
+uint64
+sys_nanosleep(void)
+{
+  uint64 ns, t;
+
+  argaddr(0, &ns);
+  t = ns / (1000000000 / TIMEBASE);  // time CSR cycles
+  return sleepuntil(r_time() + t + 1);
 }
 
 uint64
@@ -91,3 +93,74 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// copy physical memory allocator statistics
+// to the user struct memstat at addr.
+uint64
+sys_memstat(void)
+{
+  uint64 addr;
+  struct memstat st;
+
+  argaddr(0, &addr);
+  kmemstat(&st);
+  uvmstat(&st);
+  swapstat(&st);
+  ksmstat(&st);
+  if(copyout(myproc()->pagetable, addr, (char *)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+// set the same-page merger's scan rate, in pages per
+// tick, unless the argument is negative. returns the
+// old rate.
+uint64
+sys_ksm(void)
+{
+  int rate;
+
+  argint(0, &rate);
+  return ksmrate(rate);
+}
+
+// set the base scheduling level of a process (the current
+// one if the pid is 0). returns the old level, or -1.
+uint64
+sys_setpriority(void)
+{
+  int pid, level;
+
+  argint(0, &pid);
+  argint(1, &level);
+  return setpriority(pid, level);
+}
+
+// set the fair-share weight of a process (the current one
+// if the pid is 0). returns the old weight, or -1.
+uint64
+sys_setweight(void)
+{
+  int pid, weight;
+
+  argint(0, &pid);
+  argint(1, &weight);
+  return setweight(pid, weight);
+}
+
+// copy statistics for each CPU to the user array of NCPU
+// struct cpustat at addr. returns the number of CPUs that
+// have started.
+uint64
+sys_cpustat(void)
+{
+  uint64 addr;
+  struct cpustat st[NCPU];
+  int n;
+
+  argaddr(0, &addr);
+  n = cpustats(st);
+  if(copyout(myproc()->pagetable, addr, (char *)st, sizeof(st)) < 0)
+    return -1;
+  return n;
+}
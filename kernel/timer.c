@@ -0,0 +1,234 @@
+// Timers: sleeping until a given time.
+//
+// Each CPU has a hierarchical timer wheel of the processes
+// sleeping in sleepuntil() on it. A timer goes in one slot
+// of one level of the wheel, according to how far off its
+// time is: level 0 has SLOTS slots, each 2^GRAIN cycles of
+// the time CSR wide, and the slots of each level above are
+// SLOTS times as wide as those of the level below. As the
+// wheel's time passes a slot, the timers in it that are due
+// wake their processes, and the rest move down to a lower
+// level, where their slots are narrower. Adding or removing
+// a timer takes constant time, and a CPU looks only at the
+// slots its time has passed, and only at those with timers.
+//
+// The wheel runs on each timer interrupt: on clock ticks,
+// and on interrupts between ticks that alarm() asks timervec
+// (kernelvec.S) for when a timer is due before the next
+// tick, so that sleeps need not be whole ticks.
+//
+// A wheel's lock protects its slots and its timers, and is
+// what sleepuntil() sleeps with; it is taken before the
+// sleep queues' locks.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define GRAIN  7   // level 0 slots are 2^GRAIN cycles wide (12.8 us)
+#define SHIFT  6
+#define SLOTS  (1 << SHIFT)  // slots per level
+#define LEVELS 5   // level 4 slots are 2^31 cycles wide (3.5 minutes)
+
+struct timer {
+  uint64 expires;        // time CSR at which to wake
+  int fired;
+  int level;             // where it is in the wheel
+  int slot;
+  struct timer *next;
+  struct timer **pprev;  // what points to it
+};
+
+struct wheel {
+  struct spinlock lock;
+  uint64 clk;                        // time, in grains, the wheel has run up to
+  uint64 busy[LEVELS];               // bitmap of the slots holding timers
+  struct timer *slot[LEVELS][SLOTS];
+} wheel[NCPU];
+
+// in start.c, shared with timervec.
+extern uint64 timer_scratch[NCPU][9];
+
+void
+wheelinit(void)
+{
+  for(int i = 0; i < NCPU; i++){
+    initlock(&wheel[i].lock, "wheel");
+    wheel[i].clk = r_time() >> GRAIN;
+  }
+}
+
+// Put t in the wheel w, in the slot of the lowest level that
+// reaches its time. t must be due after the wheel's time.
+static void
+add(struct wheel *w, struct timer *t)
+{
+  uint64 e = (t->expires + (1 << GRAIN) - 1) >> GRAIN;  // round up
+  uint64 g, now;
+  int l;
+
+  for(l = 0; l < LEVELS-1; l++)
+    if((e >> (SHIFT*l)) - (w->clk >> (SHIFT*l)) < SLOTS)
+      break;
+  g = e >> (SHIFT*l);
+  now = w->clk >> (SHIFT*l);
+  if(g - now >= SLOTS)
+    g = now + SLOTS - 1;  // beyond the top level; goes round again
+  t->level = l;
+  t->slot = g % SLOTS;
+  t->pprev = &w->slot[l][t->slot];
+  if((t->next = *t->pprev) != 0)
+    t->next->pprev = &t->next;
+  *t->pprev = t;
+  w->busy[l] |= 1ULL << t->slot;
+}
+
+static void
+del(struct wheel *w, struct timer *t)
+{
+  if((*t->pprev = t->next) != 0)
+    t->next->pprev = t->pprev;
+  if(w->slot[t->level][t->slot] == 0)
+    w->busy[t->level] &= ~(1ULL << t->slot);
+}
+
+// Move w's time up to now: wake the processes of the timers
+// in the slots it passes that are due, and put the others
+// back in lower levels.
+static void
+advance(struct wheel *w, uint64 now)
+{
+  struct timer *list = 0, *t, *next;
+  uint64 from, to, g, n;
+  int l, s;
+
+  for(l = 0; l < LEVELS; l++){
+    from = w->clk >> (SHIFT*l);
+    to = (now >> GRAIN) >> (SHIFT*l);
+    if(to <= from)
+      break;  // and likewise for the levels above
+    n = to - from < SLOTS ? to - from : SLOTS;
+    for(g = from + 1; n > 0; g++, n--){
+      s = g % SLOTS;
+      if((w->busy[l] & (1ULL << s)) == 0)
+        continue;
+      for(t = w->slot[l][s]; t; t = next){
+        next = t->next;
+        t->next = list;
+        list = t;
+      }
+      w->slot[l][s] = 0;
+      w->busy[l] &= ~(1ULL << s);
+    }
+  }
+  if((now >> GRAIN) > w->clk)
+    w->clk = now >> GRAIN;
+
+  for(t = list; t; t = next){
+    next = t->next;
+    if(t->expires <= now){
+      t->fired = 1;
+      wakeup(t);
+    } else {
+      add(w, t);
+    }
+  }
+}
+
+// The start of the first slot of w holding a timer: no later
+// than the first timer is due, and the time at which the
+// wheel should next run. ~0 if there are no timers.
+static uint64
+first(struct wheel *w)
+{
+  uint64 t = ~0ULL, g, start;
+  int l, i;
+
+  for(l = 0; l < LEVELS; l++){
+    if(w->busy[l] == 0)
+      continue;
+    for(i = 1; i <= SLOTS; i++){
+      g = (w->clk >> (SHIFT*l)) + i;
+      if(w->busy[l] & (1ULL << (g % SLOTS)))
+        break;
+    }
+    start = g << (SHIFT*l + GRAIN);
+    if(start < t)
+      t = start;
+  }
+  return t;
+}
+
+// Ask timervec for a timer interrupt on this CPU at time t,
+// if that's before the next clock tick and any interrupt
+// already asked for. timervec may run in between these
+// steps, but mtimecmp ends up no later than it should be;
+// an early interrupt just sets it again.
+static void
+alarm(uint64 t)
+{
+  uint64 *scratch = timer_scratch[cpuid()];
+
+  if(t >= scratch[8] || t >= scratch[7])
+    return;
+  scratch[8] = t;
+  *(volatile uint64*)CLINT_MTIMECMP(cpuid()) = t;
+}
+
+// Called on each software interrupt from timervec: run this
+// CPU's wheel. Returns 1 if there has been a clock tick since
+// the last call; clearing timervec's flag must be atomic with
+// reading it.
+int
+timerintr(void)
+{
+  struct wheel *w = &wheel[cpuid()];
+
+  acquire(&w->lock);
+  advance(w, r_time());
+  alarm(first(w));
+  release(&w->lock);
+  return __sync_lock_test_and_set(&timer_scratch[cpuid()][5], 0);
+}
+
+// Sleep until the time CSR reaches deadline.
+// Returns 0, or -1 if the process was killed.
+int
+sleepuntil(uint64 deadline)
+{
+  struct timer t;
+  struct wheel *w;
+  int r = 0;
+
+  // use the wheel of the CPU this runs on while it holds the
+  // wheel's lock, so that alarm() is for the right CPU.
+  for(;;){
+    w = &wheel[cpuid()];
+    acquire(&w->lock);
+    if(w == &wheel[cpuid()])
+      break;
+    release(&w->lock);
+  }
+  if(deadline <= r_time()){
+    release(&w->lock);
+    return 0;
+  }
+  t.expires = deadline;
+  t.fired = 0;
+  add(w, &t);
+  alarm(first(w));
+  while(!t.fired){
+    if(killed(myproc())){
+      del(w, &t);
+      r = -1;
+      break;
+    }
+    sleep(&t, &w->lock);
+  }
+  release(&w->lock);
+  return r;
+}
@@ -16,6 +16,20 @@ void kernelvec();
 
 extern int devintr();
 
+// usercopy.S's exception table: pairs of the address of an
+// instruction that may fault on user memory, and the address
+// to resume at if it does.
+extern uint64 extable[], extable_end[];
+
+static uint64
+exfixup(uint64 pc)
+{
+  for(uint64 *e = extable; e < extable_end; e += 2)
+    if(e[0] == pc)
+      return e[1];
+  return 0;
+}
+
 void
 trapinit(void)
 {
@@ -65,6 +79,18 @@ usertrap(void)
     intr_on();
 
     syscall();
+  } else if(r_scause() == 12 || r_scause() == 13 || r_scause() == 15){
+    // page fault. vmfault() may sleep reading the page in,
+    // so fetch scause and stval before enabling interrupts.
+    uint64 cause = r_scause(), va = r_stval();
+
+    intr_on();
+
+    if(vmfault(p->pagetable, va, cause == 15) != 0){
+      printf("usertrap(): page fault %p pid=%d\n", cause, p->pid);
+      printf("            sepc=%p stval=%p\n", p->trapframe->epc, va);
+      setkilled(p);
+    }
   } else if((which_dev = devintr()) != 0){
     // ok
   } else {
@@ -76,9 +102,10 @@ usertrap(void)
   if(killed(p))
     exit(-1);
 
-  // give up the CPU if this is a timer interrupt.
+  // on a timer interrupt, give up the CPU if the
+  // scheduler says so.
   if(which_dev == 2)
-    yield();
+    schedtick();
 
   usertrapret();
 }
@@ -119,8 +146,9 @@ usertrapret(void)
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
-  // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  // tell trampoline.S the user page table to switch to,
+  // and the ASID to tag its TLB entries with.
+  uint64 satp = MAKE_SATP(p->pagetable, uvmasid(p));
 
   // jump to userret in trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
@@ -138,23 +166,29 @@ kerneltrap()
   uint64 sepc = r_sepc();
   uint64 sstatus = r_sstatus();
   uint64 scause = r_scause();
+  uint64 fixup;
   
   if((sstatus & SSTATUS_SPP) == 0)
     panic("kerneltrap: not from supervisor mode");
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
-  if((which_dev = devintr()) == 0){
+  if((scause == 13 || scause == 15) && (fixup = exfixup(sepc)) != 0){
+    // a page fault in ucopy(): return to its fixup code,
+    // which reports the failure.
+    sepc = fixup;
+  } else if((which_dev = devintr()) == 0){
     printf("scause %p\n", scause);
     printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
+  // on a timer interrupt, give up the CPU if the
+  // scheduler says so.
   if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
-    yield();
+    schedtick();
 
-  // the yield() may have caused some traps to occur,
+  // a yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
   w_sepc(sepc);
   w_sstatus(sstatus);
@@ -165,7 +199,6 @@ clockintr()
 {
   acquire(&tickslock);
   ticks++;
-  wakeup(&ticks);
   release(&tickslock);
 }
 
@@ -189,7 +222,9 @@ devintr()
     if(irq == UART0_IRQ){
       uartintr();
     } else if(irq == VIRTIO0_IRQ){
-      virtio_disk_intr();
+      virtio_disk_intr(0);
+    } else if(irq == VIRTIO1_IRQ){
+      virtio_disk_intr(1);
     } else if(irq){
       printf("unexpected interrupt irq=%d\n", irq);
     }
@@ -202,17 +237,22 @@ devintr()
 
     return 1;
   } else if(scause == 0x8000000000000001L){
-    // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // software interrupt from a machine-mode timer interrupt
+    // or IPI, forwarded by timervec in kernelvec.S.
 
-    if(cpuid() == 0){
-      clockintr();
-    }
-    
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
     w_sip(r_sip() & ~2);
 
+    // run the timers that are due. an IPI (see wakecpu())
+    // or a timer interrupt between ticks goes no further.
+    if(timerintr() == 0)
+      return 1;
+
+    if(cpuid() == 0){
+      clockintr();
+    }
+
     return 2;
   } else {
     return 0;
@@ -3,8 +3,12 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
+#include "fcntl.h"
+#include "memstat.h"
 
 /*
  * the kernel's page table.
@@ -15,20 +19,55 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+#define MEGAORDER 9  // kalloc_pages() order of a megapage
+
+static void uvmcollapse(pagetable_t, uint64);
+static int unshare(pte_t *, int);
+static int unshare_locked(pte_t *, int);
+static int uvmunshare(pagetable_t, uint64);
+static pte_t *walkstop(pagetable_t, uint64, int *);
+static void droptable(pte_t *, int);
+
+// fork() doesn't copy the parent's page table. The child
+// shares the parent's page-table pages that lie wholly within
+// runs of the parent's regions (see vmadup()); each has a reference (kref()) for each
+// page table that points to it. Page-table PTEs can't be made
+// read-only, so the PTEs that point to a shared page are
+// marked PTE_SHARED and not valid, and the hardware faults
+// on any access below them. fault() then gives the page table
+// its own copy of the shared page (or takes it back, if no
+// one else points to it any more), and the copy's PTEs for
+// lower-level page-table pages are shared in turn.
+//
+// A shared page-table page is never used by the hardware, so
+// the only changes to it are made while copying it, holding
+// shares.lock: its writable pages become copy-on-write, and
+// its lower-level pages become shared too.
+//
+// walk() and walklevel() don't look inside shared pages
+// unless asked to allocate, so swapping and same-page merging
+// leave the pages below them alone until they are copied.
+struct {
+  struct spinlock lock;
+} shares;
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
 {
   pagetable_t kpgtbl;
 
-  kpgtbl = (pagetable_t) kalloc();
-  memset(kpgtbl, 0, PGSIZE);
+  kpgtbl = (pagetable_t) kalloc_zeroed();
 
   // uart registers
   kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
 
-  // virtio mmio disk interface
+  // CLINT, for IPIs and timer interrupts between ticks
+  kvmmap(kpgtbl, CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+
+  // virtio mmio disk interfaces
   kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
+  kvmmap(kpgtbl, VIRTIO1, VIRTIO1, PGSIZE, PTE_R | PTE_W);
 
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
@@ -54,25 +93,194 @@ void
 kvminit(void)
 {
   kernel_pagetable = kvmmake();
+  initlock(&shares.lock, "shares");
 }
 
 // Switch h/w page table register to the kernel's page table,
-// and enable paging.
+// and enable paging. Each CPU has its own copy of the top
+// level, with a window onto user memory (see uvmwindow()).
 void
 kvminithart()
 {
+  struct cpu *c = mycpu();
+
+  if((c->kpagetable = kalloc()) == 0)
+    panic("kvminithart");
+  memmove(c->kpagetable, kernel_pagetable, PGSIZE);
+
   // wait for any previous writes to the page table memory to finish.
   sfence_vma();
 
-  w_satp(MAKE_SATP(kernel_pagetable));
+  w_satp(MAKE_SATP(c->kpagetable, 0));
 
   // flush stale entries from the TLB.
   sfence_vma();
 }
 
+// Address space identifiers. A process gets an ASID when it
+// first returns to user space, and keeps it until exec(),
+// so switching to and from its page table needn't flush
+// the TLB; the kernel's page table has ASID 0. p->asid holds
+// the ASID and the generation it is from. When the ASIDs run
+// out, a new generation starts, and processes get new ASIDs
+// from it as they next return to user space. Each CPU
+// flushes its whole TLB before running the first process
+// with an ASID from a new generation, so no stale entries
+// from an old one survive.
+//
+// Changing or removing a process's mappings leaves stale
+// entries in the TLBs of the CPUs it has run on. The CPU
+// making the change flushes its own, if the process is
+// running on it, and clears the other CPUs from p->tlbok;
+// uvmasid() flushes a CPU's entries for the process when
+// it next runs there. A process runs on one CPU at a time,
+// so there's no need to interrupt the others.
+struct {
+  struct spinlock lock;
+  uint64 max;   // largest ASID the hardware has; 0 if none
+  uint64 gen;   // current generation, above ASIDMASK
+  uint64 next;  // next ASID to hand out
+} asids;
+
+void
+asidinit(void)
+{
+  initlock(&asids.lock, "asid");
+
+  // the ASID field holds only as many bits as the
+  // hardware implements.
+  uint64 satp = r_satp();
+  w_satp(satp | SATP_ASID(ASIDMASK));
+  asids.max = SATP2ASID(r_satp());
+  w_satp(satp);
+  sfence_vma();
+
+  asids.gen = ASIDMASK + 1;
+  asids.next = 1;
+}
+
+// Return the ASID for the current process p, allocating
+// one if it has none from the current generation, after
+// flushing any stale TLB entries for it on this CPU.
+// Called by usertrapret() with interrupts off.
+uint64
+uvmasid(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  uint64 gen, cpu = 1L << cpuid();
+
+  if(asids.max == 0){
+    // no ASIDs: flush the TLB every time.
+    sfence_vma();
+    return 0;
+  }
+
+  gen = asids.gen;  // racy peek; rechecked below
+  if((p->asid & ~ASIDMASK) != gen){
+    acquire(&asids.lock);
+    if(asids.next > asids.max){
+      asids.gen += ASIDMASK + 1;
+      asids.next = 1;
+    }
+    gen = asids.gen;
+    p->asid = gen | asids.next++;
+    release(&asids.lock);
+    p->tlbok = ~0L;  // no TLB of this generation has seen it
+  }
+
+  if(c->asidgen != gen){
+    sfence_vma();
+    c->asidgen = gen;
+  } else if((p->tlbok & cpu) == 0){
+    sfence_vma_asid(p->asid & ASIDMASK);
+  }
+  p->tlbok |= cpu;
+  return p->asid & ASIDMASK;
+}
+
+// Drop TLB entries for p's mapping of va, or for all of
+// p's mappings if va is MAXVA, after changing them. If p
+// isn't the current process, the caller must hold p->lock,
+// and p must not be running.
+void
+tlbflush(struct proc *p, uint64 va)
+{
+  uint64 asid = p->asid & ASIDMASK;
+
+  push_off();
+  if(p == myproc()){
+    // the window shows p's memory too, with ASID 0.
+    // a whole-space change may free page-table pages, whose
+    // entries only a fence on the whole space drops.
+    if(va == MAXVA){
+      sfence_vma_asid(asid);
+      sfence_vma_asid(0);
+    } else {
+      sfence_vma_page(va, asid);
+      sfence_vma_page(UWINDOW + va, 0);
+    }
+    p->tlbok = p->winok = 1L << cpuid();
+  } else {
+    p->tlbok = p->winok = 0;
+  }
+  pop_off();
+}
+
+// Show pagetable's user memory in this CPU's window at
+// UWINDOW, where copyin() and copyout() reach it without
+// walking the page table. The scheduler calls this before
+// running a process, so the window always shows the current
+// process. The window's top-level entries are copies, but
+// they point to the page table's own lower levels, so only
+// changes to the top level need another call.
+//
+// The window's TLB entries have ASID 0, as the kernel's own
+// do, and a fence on a single address needn't drop cached
+// upper-level entries, so showing a different page table
+// takes a fence on all of ASID 0. This CPU can skip it only
+// if the window already shows pagetable, and pagetable's
+// process has changed no mappings since this CPU last
+// flushed the window for it (p->winok; see tlbflush()).
+void
+uvmwindow(pagetable_t pagetable)
+{
+  struct cpu *c;
+  struct proc *p;
+  pagetable_t kpt;
+  uint64 cpu;
+
+  push_off();
+  c = mycpu();
+  p = c->proc;
+  cpu = 1L << cpuid();
+  kpt = c->kpagetable;
+  if(p == 0 || p->pagetable != pagetable || (p->winok & cpu) == 0 ||
+     memcmp(&kpt[PX(2, UWINDOW)], pagetable, PX(2, UWINDOW) * sizeof(pte_t)) != 0){
+    memmove(&kpt[PX(2, UWINDOW)], pagetable, PX(2, UWINDOW) * sizeof(pte_t));
+    sfence_vma_asid(0);
+    if(p && p->pagetable == pagetable)
+      p->winok |= cpu;
+  }
+  pop_off();
+}
+
+// tlbflush() for the current process, if pagetable is its
+// page table. Others' page tables are either new or being
+// freed, so the TLBs can't hold entries for them.
+static void
+uvmflush(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myproc();
+
+  if(p && p->pagetable == pagetable)
+    tlbflush(p, va);
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
+// If va is mapped by a megapage or gigapage, return
+// that higher-level leaf PTE.
 //
 // The risc-v Sv39 scheme has three levels of page-table
 // pages. A page-table page contains 512 64-bit PTEs.
@@ -84,55 +292,101 @@ kvminithart()
 //    0..11 -- 12 bits of byte offset within the page.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  int level = 0;
+
+  return walklevel(pagetable, va, alloc, &level);
+}
+
+// Like walk(), but return the PTE at *level rather than
+// at level 0, only creating page-table pages above *level.
+// Sets *level to the level of the returned PTE, which is
+// higher than asked for if a higher-level leaf maps va.
+// Returns 0 if va is below a shared page-table page, unless
+// alloc is set, in which case it copies the shared page.
+pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int alloc, int *level)
 {
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
-    pte_t *pte = &pagetable[PX(level, va)];
+  for(int l = 2; l > *level; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
+    if((*pte & PTE_SHARED) && (!alloc || unshare(pte, l) != 0))
+      return 0;
     if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte)){
+        *level = l;
+        return pte;
+      }
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  return &pagetable[PX(*level, va)];
 }
 
-// Look up a virtual address, return the physical address,
-// or 0 if not mapped.
+// Look up a virtual address, return the physical address
+// of its page, or 0 if not mapped.
 // Can only be used to look up user pages.
 uint64
 walkaddr(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
   uint64 pa;
+  int level = 0;
 
   if(va >= MAXVA)
     return 0;
 
-  pte = walk(pagetable, va, 0);
+  pte = walklevel(pagetable, va, 0, &level);
   if(pte == 0)
     return 0;
   if((*pte & PTE_V) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
-  pa = PTE2PA(*pte);
+  pa = PTE2PA(*pte) + PGROUNDDOWN(va & (LEAFSIZE(level) - 1));
   return pa;
 }
 
-// add a mapping to the kernel page table.
+// add a mapping to the kernel page table, using the
+// largest leaf PTEs (gigapages, megapages, or pages)
+// that the alignment of va and pa and the size allow,
+// to save page-table pages and TLB entries, unless
+// built with -DSMALLKVM.
 // only used when booting.
 // does not flush TLB or enable paging.
 void
 kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kpgtbl, va, sz, pa, perm) != 0)
-    panic("kvmmap");
+  uint64 a, last;
+  pte_t *pte;
+  int level;
+
+  a = PGROUNDDOWN(va);
+  last = PGROUNDUP(va + sz);
+  while(a < last){
+    level = 0;
+#ifndef SMALLKVM
+    for(level = 2; level > 0; level--){
+      if(a % LEAFSIZE(level) == 0 && pa % LEAFSIZE(level) == 0 &&
+         a + LEAFSIZE(level) <= last)
+        break;
+    }
+#endif
+    int l = level;
+    if((pte = walklevel(kpgtbl, a, 1, &l)) == 0)
+      panic("kvmmap");
+    if((*pte & PTE_V) || l != level)
+      panic("kvmmap: remap");
+    *pte = PA2PTE(pa) | perm | PTE_V;
+    a += LEAFSIZE(level);
+    pa += LEAFSIZE(level);
+  }
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
@@ -165,30 +419,78 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 }
 
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that were never mapped (lazily
+// allocated pages that were never touched) are skipped,
+// a page-table page's worth at a time where there's no
+// page-table page, and pages in swap give up their swap
+// slots. Shared
+// page-table pages within the range are let go of, and
+// ones only partly within it are copied first.
+// A megapage that is only partly unmapped is split first;
+// callers that can't tolerate a panic if that or copying a
+// shared page-table page runs out of memory should call
+// uvmcut() at both ends of the range themselves.
 // Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  uint64 a, end;
   pte_t *pte;
+  int level;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
+  end = va + npages*PGSIZE;
+  for(a = va; a < end; a += PGSIZE){
+    level = 0;
+    if((pte = walklevel(pagetable, a, 0, &level)) == 0){
+      pte = walkstop(pagetable, a, &level);
+      if((*pte & PTE_SHARED) == 0){
+        // no page-table page: nothing mapped in its range.
+        a = (a | (LEAFSIZE(level) - 1)) + 1 - PGSIZE;
+        continue;
+      }
+      if(a % LEAFSIZE(level) == 0 && a + LEAFSIZE(level) <= end){
+        droptable(pte, level);
+        a += LEAFSIZE(level) - PGSIZE;
+        continue;
+      }
+      if(uvmunshare(pagetable, a) != 0)
+        panic("uvmunmap: unshare");
+      level = 0;
+      if((pte = walklevel(pagetable, a, 0, &level)) == 0)
+        continue;
+    }
+    if(*pte & PTE_SWAP){
+      if(do_free)
+        swapfree(PTE2SWAP(*pte));
+      *pte = 0;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+      continue;
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
+    if(level > 0){
+      if(a % MEGAPGSIZE == 0 && a + MEGAPGSIZE <= end){
+        if(do_free)
+          kfree_pages((void*)PTE2PA(*pte), MEGAORDER);
+        *pte = 0;
+        a += MEGAPGSIZE - PGSIZE;
+        continue;
+      }
+      if(uvmsplit(pagetable, a) != 0)
+        panic("uvmunmap: split");
+      pte = walk(pagetable, a, 0);
+    }
     if(do_free){
       uint64 pa = PTE2PA(*pte);
       kfree((void*)pa);
     }
     *pte = 0;
   }
+  uvmflush(pagetable, npages == 1 ? va : MAXVA);
 }
 
 // create an empty user page table.
@@ -197,10 +499,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -214,14 +515,46 @@ uvmfirst(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("uvmfirst: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
 
+// user megapages mapped, by uvmallocmega() or uvmcollapse().
+static uint64 nmega;
+
+void
+uvmstat(struct memstat *st)
+{
+  st->megapages = nmega;
+}
+
+// Map a zeroed megapage at va, which must be megapage-aligned.
+// Returns 0 on success, -1 if there is no free megapage or
+// part of the range already has a page-table page.
+static int
+uvmallocmega(pagetable_t pagetable, uint64 va, int perm)
+{
+  pte_t *pte;
+  char *mem;
+  int level = 1;
+
+  if((mem = kalloc_pages(MEGAORDER)) == 0)
+    return -1;
+  if((pte = walklevel(pagetable, va, 1, &level)) == 0 || (*pte & PTE_V)){
+    kfree_pages(mem, MEGAORDER);
+    return -1;
+  }
+  memset(mem, 0, MEGAPGSIZE);
+  *pte = PA2PTE(mem) | perm | PTE_V;
+  __sync_fetch_and_add(&nmega, 1);
+  return 0;
+}
+
 // Allocate PTEs and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
+// Megapage-aligned stretches that fit entirely get megapages
+// if any are free.
 uint64
 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 {
@@ -233,12 +566,16 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    if(a % MEGAPGSIZE == 0 && a + MEGAPGSIZE <= newsz &&
+       uvmallocmega(pagetable, a, PTE_R|PTE_U|xperm) == 0){
+      a += MEGAPGSIZE - PGSIZE;
+      continue;
+    }
+    mem = ualloc(1);
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -251,7 +588,8 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
-// process size.  Returns the new process size.
+// process size.  Returns the new process size, or oldsz if a
+// megapage straddling newsz could not be split.
 uint64
 uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 {
@@ -259,6 +597,11 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
     return oldsz;
 
   if(PGROUNDUP(newsz) < PGROUNDUP(oldsz)){
+    if(uvmunshare(pagetable, PGROUNDUP(newsz)) != 0)
+      return oldsz;
+    if(PGROUNDUP(newsz) % MEGAPGSIZE != 0 &&
+       uvmsplit(pagetable, PGROUNDUP(newsz)) != 0)
+      return oldsz;
     int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
     uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1);
   }
@@ -266,83 +609,566 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
   return newsz;
 }
 
-// Recursively free page-table pages.
-// All leaf mappings must already have been removed.
+// Free user memory pages, and page-table pages, shared or
+// not. Only the parts of the address space with page-table
+// pages cost anything. The trampoline and trapframe must
+// already have been unmapped.
 void
-freewalk(pagetable_t pagetable)
+uvmfree(pagetable_t pagetable)
 {
-  // there are 2^9 = 512 PTEs in a page table.
   for(int i = 0; i < 512; i++){
-    pte_t pte = pagetable[i];
-    if((pte & PTE_V) && (pte & (PTE_R|PTE_W|PTE_X)) == 0){
-      // this PTE points to a lower-level page table.
-      uint64 child = PTE2PA(pte);
-      freewalk((pagetable_t)child);
-      pagetable[i] = 0;
-    } else if(pte & PTE_V){
-      panic("freewalk: leaf");
-    }
+    pte_t *pte = &pagetable[i];
+    if((*pte & PTE_SHARED) || ((*pte & PTE_V) && !PTE_LEAF(*pte)))
+      droptable(pte, 2);
+    else if(*pte & (PTE_V|PTE_SWAP))
+      panic("uvmfree: leaf");
   }
   kfree((void*)pagetable);
 }
 
-// Free user memory pages,
-// then free page-table pages.
-void
-uvmfree(pagetable_t pagetable, uint64 sz)
+// Prepare pagetable for unmapping a range that starts or
+// ends at va: give it its own copies of any shared page-table
+// pages on the way to va, and split a megapage that va is in
+// the middle of, so that uvmunmap() won't need memory.
+// Returns 0, or -1 if out of memory.
+int
+uvmcut(pagetable_t pagetable, uint64 va)
+{
+  if(va >= MAXVA)
+    return 0;
+  if(uvmunshare(pagetable, va) != 0)
+    return -1;
+  if(va % MEGAPGSIZE != 0 && uvmsplit(pagetable, va) != 0)
+    return -1;
+  return 0;
+}
+
+// Make the PTE at *pte, in the page table at the given
+// level, and at va, shared with a copy of it in another page
+// table: a writable page becomes copy-on-write, a paged-out
+// page's slot and a page's memory get another reference, and
+// a page-table page becomes shared. Returns the PTE for the
+// copy, or 0 if there's nothing mapped.
+// Caller must hold shares.lock.
+static pte_t
+sharepte(pte_t *pte, int level)
+{
+  if(*pte & PTE_SWAP){
+    // share the swap slot; whichever reads the page
+    // back in first gets its own copy.
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+    swapdup(PTE2SWAP(*pte));
+  } else if((*pte & PTE_V) && !PTE_LEAF(*pte)){
+    *pte = (*pte & ~PTE_V) | PTE_SHARED;
+    kref((void*)PTE2PA(*pte));
+  } else if(*pte & PTE_SHARED){
+    kref((void*)PTE2PA(*pte));
+  } else if(*pte & PTE_V){
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+    if(level > 0)
+      kref_pages((void*)PTE2PA(*pte), MEGAORDER);
+    else
+      kref((void*)PTE2PA(*pte));
+  }
+  return *pte;
+}
+
+// Fill new, a page-table page at level mapping from va,
+// with old's mappings in [start, end), sharing page-table
+// pages that lie wholly within it. new may hold mappings of
+// other ranges already.
+// Returns 0, or -1 if out of memory.
+// Caller must hold shares.lock.
+static int
+sharetable(pagetable_t old, pagetable_t new, int level, uint64 va,
+           uint64 start, uint64 end)
 {
-  if(sz > 0)
-    uvmunmap(pagetable, 0, PGROUNDUP(sz)/PGSIZE, 1);
-  freewalk(pagetable);
+  pagetable_t pt;
+  uint64 next;
+
+  for(int i = 0; i < 512 && va < end; i++, va = next){
+    pte_t *pte = &old[i];
+    next = va + LEAFSIZE(level);
+    if(next <= start)
+      continue;
+    if(level == 0 || (*pte & (PTE_V|PTE_SHARED)) == 0 || PTE_LEAF(*pte) ||
+       (va >= start && next <= end)){
+      if(new[i] == 0)  // a megapage in two ranges is shared once
+        new[i] = sharepte(pte, level);
+      continue;
+    }
+    // a page-table page that is only partly in the range.
+    if((*pte & PTE_SHARED) && unshare_locked(pte, level) != 0)
+      return -1;
+    if(new[i] & PTE_V){
+      pt = (pagetable_t)PTE2PA(new[i]);
+    } else {
+      if((pt = (pagetable_t)kalloc_zeroed()) == 0)
+        return -1;
+      new[i] = PA2PTE(pt) | PTE_V;
+    }
+    if(sharetable((pagetable_t)PTE2PA(*pte), pt, level-1, va, start, end) != 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Give the page table whose PTE at level is *pte, which
+// points to a shared page-table page, its own copy of that
+// page; or take the page back, if no other page table
+// points to it any more.
+// Returns 0, or -1 if out of memory.
+// Caller must hold shares.lock.
+static int
+unshare_locked(pte_t *pte, int level)
+{
+  pagetable_t old = (pagetable_t)PTE2PA(*pte), new;
+
+  if(krefcnt(old) == 1){
+    *pte = PA2PTE(old) | PTE_V;
+    return 0;
+  }
+  if((new = (pagetable_t)kalloc()) == 0)
+    return -1;
+  for(int i = 0; i < 512; i++)
+    new[i] = sharepte(&old[i], level-1);
+  *pte = PA2PTE(new) | PTE_V;
+  kfree(old);
+  return 0;
+}
+
+static int
+unshare(pte_t *pte, int level)
+{
+  int r;
+
+  acquire(&shares.lock);
+  r = unshare_locked(pte, level);
+  release(&shares.lock);
+  return r;
+}
+
+// Give pagetable its own copies of any shared page-table
+// pages on the way to va.
+// Returns 0, or -1 if out of memory.
+static int
+uvmunshare(pagetable_t pagetable, uint64 va)
+{
+  for(int l = 2; l > 0; l--){
+    pte_t *pte = &pagetable[PX(l, va)];
+    if((*pte & PTE_SHARED) && unshare(pte, l) != 0)
+      return -1;
+    if((*pte & PTE_V) == 0 || PTE_LEAF(*pte))
+      break;
+    pagetable = (pagetable_t)PTE2PA(*pte);
+  }
+  return 0;
+}
+
+// Return the PTE that stops a walk down to va short of
+// level 0, setting *level to its level: one that maps
+// nothing, or points to a shared page-table page.
+// Returns 0 if the walk gets to level 0 or to a megapage.
+static pte_t *
+walkstop(pagetable_t pagetable, uint64 va, int *level)
+{
+  for(int l = 2; l > 0; l--){
+    pte_t *pte = &pagetable[PX(l, va)];
+    if((*pte & PTE_V) == 0){
+      *level = l;
+      return pte;
+    }
+    if(PTE_LEAF(*pte))
+      break;
+    pagetable = (pagetable_t)PTE2PA(*pte);
+  }
+  return 0;
+}
+
+// Clear *pte, at level, which points to a page-table page,
+// shared or not, and let go of that page. If no other page
+// table points to it, free it and everything it maps.
+static void
+droptable(pte_t *pte, int level)
+{
+  pagetable_t pt = (pagetable_t)PTE2PA(*pte);
+
+  *pte = 0;
+  acquire(&shares.lock);
+  if(krefcnt(pt) > 1){
+    kfree(pt);
+    release(&shares.lock);
+    return;
+  }
+  release(&shares.lock);
+
+  // no one else can reach pt now.
+  for(int i = 0; i < 512; i++){
+    pte_t *p = &pt[i];
+    if(*p & PTE_SWAP)
+      swapfree(PTE2SWAP(*p));
+    else if(*p & PTE_SHARED)
+      droptable(p, level-1);
+    else if((*p & PTE_V) && !PTE_LEAF(*p))
+      droptable(p, level-1);
+    else if((*p & PTE_V) && level > 1)
+      kfree_pages((void*)PTE2PA(*p), MEGAORDER);
+    else if(*p & PTE_V)
+      kfree((void*)PTE2PA(*p));
+    *p = 0;
+  }
+  kfree(pt);
 }
 
-// Given a parent process's page table, copy
-// its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
-// returns 0 on success, -1 on failure.
-// frees any allocated pages on failure.
+// Give new, the page table of fork()'s child, old's mappings
+// of the page-aligned range [start, end): new shares old's
+// page-table pages that lie wholly within the range, and
+// copies the rest of the page table down to the range,
+// sharing the physical memory. Writable pages that aren't
+// below a shared page-table page become read-only
+// copy-on-write pages in both parent and child, and are
+// copied by uvmcow() when either writes.
+// returns 0 on success, -1 if out of memory, in which case
+// new may hold some of the mappings; uvmfree() frees them.
 int
-uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+uvmcopy(pagetable_t old, pagetable_t new, uint64 start, uint64 end)
 {
+  struct proc *p = myproc();
+  int r;
+
+  acquire(&shares.lock);
+  r = sharetable(old, new, 2, 0, start, end);
+  release(&shares.lock);
+  // the parent's writable pages are now copy-on-write, and
+  // it mustn't reach the shared pages through the window.
+  uvmflush(old, MAXVA);
+  if(p && p->pagetable == old)
+    uvmwindow(old);
+  return r;
+}
+
+// Return the PTE of the first user page mapped at or above
+// *va, setting *va to its address. Skips megapages, and
+// pages below shared page-table pages.
+// Returns 0 if there's none below MAXVA.
+pte_t *
+uvmnext(pagetable_t pagetable, uint64 *va)
+{
+  pagetable_t pt;
   pte_t *pte;
-  uint64 pa, i;
-  uint flags;
-  char *mem;
+  int level;
 
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
-    pa = PTE2PA(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
-      goto err;
+  while(*va < MAXVA){
+    pt = pagetable;
+    for(level = 2; level > 0; level--){
+      pte = &pt[PX(level, *va)];
+      if((*pte & PTE_V) == 0 || PTE_LEAF(*pte))
+        break;
+      pt = (pagetable_t)PTE2PA(*pte);
+    }
+    if(level > 0){
+      // nothing mapped here, or a megapage: skip it.
+      *va = (*va + LEAFSIZE(level)) & ~(LEAFSIZE(level) - 1);
+      continue;
     }
+    pte = &pt[PX(0, *va)];
+    if((*pte & (PTE_V|PTE_U)) == (PTE_V|PTE_U))
+      return pte;
+    *va += PGSIZE;
   }
   return 0;
+}
+
+// The current process is about to use or change its page
+// table in a way that reclaim() must not interfere with,
+// perhaps sleeping or being preempted part way through.
+// Calls nest; each must be matched by a call to uvmend().
+void
+uvmbegin(void)
+{
+  struct proc *p = myproc();
 
- err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
-  return -1;
+  if(p)
+    p->vmbusy++;
 }
 
-// mark a PTE invalid for user access.
-// used by exec for the user stack guard page.
 void
-uvmclear(pagetable_t pagetable, uint64 va)
+uvmend(void)
 {
+  struct proc *p = myproc();
+
+  if(p)
+    p->vmbusy--;
+}
+
+static int fault(pagetable_t, uint64, int);
+
+// Handle a page fault on user address va in the current
+// process's page table: a write to a copy-on-write page,
+// the first touch of a program page that exec() didn't
+// read in or of a heap page that sbrk() reserved without
+// allocating, an access to a mapped file, or to a page
+// that was paged out to swap.
+// write says whether the access was a store.
+// Returns 0 if the page is now mapped and allows the access,
+// -1 if the access is not allowed or memory is exhausted.
+int
+vmfault(pagetable_t pagetable, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  int r;
+
+  uvmbegin();
+  r = fault(pagetable, va, write);
+  uvmend();
+  if(r == 0 && p && pagetable == p->pagetable){
+    // this CPU's TLB may remember that the page wasn't
+    // mapped, or didn't allow the access.
+    sfence_vma_page(PGROUNDDOWN(va), p->asid & ASIDMASK);
+    sfence_vma_page(UWINDOW + PGROUNDDOWN(va), 0);
+  }
+  return r;
+}
+
+// Fault in the pages of the current process's file-backed
+// regions, mapped files and the program, between va and
+// va+len that aren't mapped, or aren't writable if write
+// is set. A fault on one of them locks the file's inode, so
+// read() and write() call this before locking their own
+// inode, lest two processes each copy between one file and
+// a mapping of the other, and deadlock. Best effort: the
+// copy itself fails on any page that can't be faulted in.
+void
+uvmprefault(uint64 va, uint64 len, int write)
+{
+  struct proc *p = myproc();
+  struct vma *v;
   pte_t *pte;
-  
+  uint64 a, end;
+
+  if(va >= MAXVA || len > MAXVA - va)
+    return;
+  end = va + len;
+  for(v = vmanext(&p->vmas, va); v && v->start < end; v = vmanext(&p->vmas, v->end)){
+    if(v->type == VMA_ANON)
+      continue;
+    for(a = PGROUNDDOWN(va > v->start ? va : v->start); a < v->end && a < end; a += PGSIZE){
+      pte = walk(p->pagetable, a, 0);
+      if(pte == 0 || (*pte & PTE_V) == 0 || (write && (*pte & PTE_W) == 0))
+        vmfault(p->pagetable, a, write);
+    }
+  }
+}
+
+static int
+fault(pagetable_t pagetable, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  pte_t *pte;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+
+  // va may be below page-table pages shared since fork().
+  while(uvmunshare(pagetable, va) != 0)
+    if(reclaim() == 0)
+      return -1;
+
   pte = walk(pagetable, va, 0);
-  if(pte == 0)
-    panic("uvmclear");
-  *pte &= ~PTE_U;
+  if(pte && (*pte & PTE_SWAP)){
+    if(p == 0 || pagetable != p->pagetable)
+      return -1;
+    if(swapin(pte) != 0)
+      return -1;
+    if(!write || (*pte & PTE_W))
+      return 0;
+  }
+  if(pte && (*pte & PTE_V)){
+    if(write && (*pte & PTE_W) == 0){
+      if(*pte & PTE_COW)
+        return uvmcow(pagetable, va);
+      if(p && pagetable == p->pagetable &&
+         (v = vmalookup(&p->vmas, va)) != 0 && v->type == VMA_FILE)
+        return mmapfault(v, va, write);
+      return -1;
+    }
+    if((*pte & PTE_U) && (*pte & (write ? PTE_W : PTE_R)))
+      return 0;  // a stale TLB entry; vmfault() flushes it
+    return -1;
+  }
+
+  // not mapped: is it part of the program, the heap or
+  // stack, or a mapped file?
+  if(p == 0 || pagetable != p->pagetable)
+    return -1;
+  if((v = vmalookup(&p->vmas, va)) == 0)
+    return -1;
+  if((v->prot & PROT_READ) == 0 || (write && (v->prot & PROT_WRITE) == 0))
+    return -1;
+  if(v->type == VMA_FILE)
+    return mmapfault(v, va, write);
+  if(v->type == VMA_EXEC)
+    return execfault(v, va, write);
+  if((mem = ualloc(1)) == 0)
+    return -1;
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, vmaperm(v)) != 0){
+    kfree(mem);
+    return -1;
+  }
+  uvmcollapse(pagetable, va);
+  return 0;
+}
+
+// Split the megapage that maps va, if there is one, into
+// page mappings of the same memory.
+// Returns 0 on success, -1 if there's no memory for the
+// page-table page.
+int
+uvmsplit(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  pagetable_t pt;
+  uint64 pa;
+  int level = 1;
+
+  if(va >= MAXVA)
+    return 0;
+  if(uvmunshare(pagetable, va) != 0)
+    return -1;
+  pte = walklevel(pagetable, va, 0, &level);
+  if(pte == 0 || (*pte & PTE_V) == 0 || !PTE_LEAF(*pte))
+    return 0;
+  if((pt = (pagetable_t)kalloc()) == 0)
+    return -1;
+  pa = PTE2PA(*pte);
+  ksplit((void*)pa);
+  for(int i = 0; i < 512; i++)
+    pt[i] = PA2PTE(pa + i*PGSIZE) | PTE_FLAGS(*pte);
+  *pte = PA2PTE(pt) | PTE_V;
+  uvmflush(pagetable, va);
+  return 0;
+}
+
+// Is pte a private user page that could be moved into
+// a megapage with the given flags? The accessed and dirty
+// bits, which the hardware may set, don't matter.
+static int
+collapsible(pte_t pte, uint flags)
+{
+  return (pte & PTE_V) && (PTE_FLAGS(pte) & ~(PTE_A|PTE_D)) == flags &&
+    krefcnt((void*)PTE2PA(pte)) == 1;
+}
+
+// If va's page completes a megapage-aligned region of
+// private, writable pages, copy them into a megapage.
+// Best effort: does nothing if the region isn't complete
+// or no megapage is free.
+static void
+uvmcollapse(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  pagetable_t pt;
+  uint64 pa;
+  uint flags;
+  char *mem;
+  int i, level = 1;
+
+  pte = walklevel(pagetable, va, 0, &level);
+  if(pte == 0 || level != 1 || (*pte & PTE_V) == 0 || PTE_LEAF(*pte))
+    return;
+  pt = (pagetable_t)PTE2PA(*pte);
+  i = PX(0, va);
+  flags = PTE_FLAGS(pt[i]) & ~(PTE_A|PTE_D);
+  if((flags & (PTE_V|PTE_U|PTE_W|PTE_COW)) != (PTE_V|PTE_U|PTE_W))
+    return;
+
+  // look at the neighbours first, so that filling a region
+  // in either direction doesn't rescan it on every fault.
+  if((i < 511 && !collapsible(pt[i+1], flags)) ||
+     (i > 0 && !collapsible(pt[i-1], flags)))
+    return;
+  for(i = 0; i < 512; i++)
+    if(!collapsible(pt[i], flags))
+      return;
+
+  if((mem = kalloc_pages(MEGAORDER)) == 0)
+    return;
+  for(i = 0; i < 512; i++){
+    pa = PTE2PA(pt[i]);
+    memmove(mem + i*PGSIZE, (char*)pa, PGSIZE);
+    kfree((void*)pa);
+  }
+  *pte = PA2PTE(mem) | flags;
+  kfree(pt);
+  uvmflush(pagetable, MAXVA);
+  __sync_fetch_and_add(&nmega, 1);
+}
+
+// Handle a write to the copy-on-write page at va: give the
+// page table a private, writable copy of the page, or just make
+// the page writable if no one else shares it any more.
+// Returns 0 on success, -1 if va is not a copy-on-write
+// page or there's no memory for the copy.
+int
+uvmcow(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  if(uvmsplit(pagetable, va) != 0)
+    return -1;
+  if((pte = walk(pagetable, va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U|PTE_COW))
+    return -1;
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW;
+
+  if(krefcnt((void*)pa) == 1){
+    *pte = PA2PTE(pa) | flags;
+    uvmflush(pagetable, va);
+    return 0;
+  }
+
+  // hold on to the page: if the other sharers let go of
+  // it, ualloc() might page it out.
+  kref((void*)pa);
+  if((mem = ualloc(0)) == 0){
+    kfree((void*)pa);
+    return -1;
+  }
+  memmove(mem, (char*)pa, PGSIZE);
+  *pte = PA2PTE(mem) | flags;
+  uvmflush(pagetable, va);
+  kfree((void*)pa);
+  kfree((void*)pa);
+  return 0;
+}
+
+// Can copyin() and copyout() reach [va, va+len) of pagetable
+// through the window? It shows only the current process's
+// page table. The hardware would let the kernel reach the
+// pages that aren't user pages there too: the trapframe
+// and the trampoline.
+static int
+inwindow(pagetable_t pagetable, uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+
+  if(p == 0 || pagetable != p->pagetable)
+    return 0;
+  if(va >= TRAPFRAME || len > TRAPFRAME - va)
+    return 0;
+  return 1;
 }
 
 // Copy from kernel to user.
@@ -352,12 +1178,38 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  pte_t *pte;
+  int level, r = 0;
+
+  if(inwindow(pagetable, dstva, len)){
+    if(ucopy((void*)(UWINDOW + dstva), src, len) == 0)
+      return 0;
+    // a page is missing, or copy-on-write, or the window
+    // lacks a new top-level entry: do it the slow way.
+    uvmwindow(pagetable);
+  }
 
+  uvmbegin();
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
-      return -1;
+    if(va0 >= MAXVA){
+      r = -1;
+      break;
+    }
+    level = 0;
+    pte = walklevel(pagetable, va0, 0, &level);
+    if(pte == 0 || (*pte & (PTE_V|PTE_U|PTE_W)) != (PTE_V|PTE_U|PTE_W)){
+      // not yet allocated, copy-on-write, or in swap?
+      if(vmfault(pagetable, va0, 1) != 0){
+        r = -1;
+        break;
+      }
+      level = 0;
+      pte = walklevel(pagetable, va0, 0, &level);
+    }
+    // the hardware doesn't see this write, so tell reclaim().
+    *pte |= PTE_A | PTE_D;
+    pa0 = PTE2PA(*pte) + (va0 & (LEAFSIZE(level) - 1));
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
@@ -367,7 +1219,8 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
     src += n;
     dstva = va0 + PGSIZE;
   }
-  return 0;
+  uvmend();
+  return r;
 }
 
 // Copy from user to kernel.
@@ -377,12 +1230,25 @@ int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
+  int r = 0;
 
+  if(inwindow(pagetable, srcva, len)){
+    if(ucopy(dst, (void*)(UWINDOW + srcva), len) == 0)
+      return 0;
+    uvmwindow(pagetable);
+  }
+
+  uvmbegin();
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
-      return -1;
+    if(pa0 == 0){
+      if(vmfault(pagetable, va0, 0) != 0){
+        r = -1;
+        break;
+      }
+      pa0 = walkaddr(pagetable, va0);
+    }
     n = PGSIZE - (srcva - va0);
     if(n > len)
       n = len;
@@ -392,7 +1258,8 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
     dst += n;
     srcva = va0 + PGSIZE;
   }
-  return 0;
+  uvmend();
+  return r;
 }
 
 // Copy a null-terminated string from user to kernel.
@@ -403,13 +1270,23 @@ int
 copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
   uint64 n, va0, pa0;
-  int got_null = 0;
+  int got_null = 0, r;
+
+  if(inwindow(pagetable, srcva, max)){
+    if((r = ucopystr(dst, (char*)(UWINDOW + srcva), max)) >= 0)
+      return -r;
+    uvmwindow(pagetable);
+  }
 
+  uvmbegin();
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
-      return -1;
+    if(pa0 == 0){
+      if(vmfault(pagetable, va0, 0) != 0)
+        break;
+      pa0 = walkaddr(pagetable, va0);
+    }
     n = PGSIZE - (srcva - va0);
     if(n > max)
       n = max;
@@ -431,6 +1308,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 
     srcva = va0 + PGSIZE;
   }
+  uvmend();
   if(got_null){
     return 0;
   } else {
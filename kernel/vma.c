@@ -0,0 +1,407 @@
+// Regions of a process's address space.
+//
+// A process's address space is a set of regions (struct
+// vma), each with its permissions and the kind of memory
+// behind it: zeros (the heap and the stack), a segment of
+// the program file, or a mapped file. fault() looks up the
+// region of an address the first time it is touched, and
+// fork(), exit(), exec() and sbrk() work region by region,
+// so their costs follow what is mapped, not how high in the
+// address space it is.
+//
+// The regions are kept in an AVL tree ordered by address,
+// with at most NVMA of them. Regions never overlap, so
+// trimming a region in place keeps the tree in order.
+//
+// exec() puts each program segment in a VMA_EXEC region,
+// followed by an unmapped guard page and a one-page stack;
+// the heap grows up from the top of the stack region. mmap()
+// places files below the trapframe, each below the last.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "fcntl.h"
+
+struct {
+  struct kmem_cache *cache;
+} vma;
+
+void
+vmainit(void)
+{
+  vma.cache = kmem_cache_create("vma", sizeof(struct vma));
+}
+
+static int
+height(struct vma *v)
+{
+  return v ? v->height : 0;
+}
+
+static void
+update(struct vma *v)
+{
+  int l = height(v->left), r = height(v->right);
+
+  v->height = (l > r ? l : r) + 1;
+}
+
+static struct vma*
+rotright(struct vma *v)
+{
+  struct vma *l = v->left;
+
+  v->left = l->right;
+  l->right = v;
+  update(v);
+  update(l);
+  return l;
+}
+
+static struct vma*
+rotleft(struct vma *v)
+{
+  struct vma *r = v->right;
+
+  v->right = r->left;
+  r->left = v;
+  update(v);
+  update(r);
+  return r;
+}
+
+// restore the balance of v, whose subtrees are balanced and
+// differ in height by at most two. returns the new root.
+static struct vma*
+balance(struct vma *v)
+{
+  int b = height(v->left) - height(v->right);
+
+  if(b > 1){
+    if(height(v->left->left) < height(v->left->right))
+      v->left = rotleft(v->left);
+    return rotright(v);
+  }
+  if(b < -1){
+    if(height(v->right->right) < height(v->right->left))
+      v->right = rotright(v->right);
+    return rotleft(v);
+  }
+  update(v);
+  return v;
+}
+
+static struct vma*
+insert(struct vma *root, struct vma *v)
+{
+  if(root == 0)
+    return v;
+  if(v->start < root->start)
+    root->left = insert(root->left, v);
+  else
+    root->right = insert(root->right, v);
+  return balance(root);
+}
+
+// remove the leftmost node of root, setting *min to it.
+static struct vma*
+removemin(struct vma *root, struct vma **min)
+{
+  if(root->left == 0){
+    *min = root;
+    return root->right;
+  }
+  root->left = removemin(root->left, min);
+  return balance(root);
+}
+
+static struct vma*
+delete(struct vma *root, struct vma *v)
+{
+  struct vma *m;
+
+  if(v->start < root->start){
+    root->left = delete(root->left, v);
+  } else if(v->start > root->start){
+    root->right = delete(root->right, v);
+  } else {
+    if(root->left == 0)
+      return root->right;
+    if(root->right == 0)
+      return root->left;
+    root->right = removemin(root->right, &m);
+    m->left = root->left;
+    m->right = root->right;
+    root = m;
+  }
+  return balance(root);
+}
+
+// The region of t that contains va, or 0.
+struct vma*
+vmalookup(struct vmatree *t, uint64 va)
+{
+  struct vma *v = t->root;
+
+  while(v){
+    if(va < v->start)
+      v = v->left;
+    else if(va >= v->end)
+      v = v->right;
+    else
+      return v;
+  }
+  return 0;
+}
+
+// The lowest region of t that ends above va, or 0.
+// Walk the regions in order with
+//   for(v = vmanext(t, 0); v; v = vmanext(t, v->end))
+struct vma*
+vmanext(struct vmatree *t, uint64 va)
+{
+  struct vma *v = t->root, *next = 0;
+
+  while(v){
+    if(v->end > va){
+      next = v;
+      v = v->left;
+    } else {
+      v = v->right;
+    }
+  }
+  return next;
+}
+
+// Add a region of the given type covering [start, end),
+// which must be page-aligned, to t. The caller fills in
+// the rest of its fields.
+// Returns the region, or 0 if the range is empty, overlaps
+// another region or the trapframe, t has NVMA regions
+// already, or memory is exhausted.
+struct vma*
+vmaadd(struct vmatree *t, uint64 start, uint64 end, int prot, int type)
+{
+  struct vma *v;
+
+  if(start >= end || end > TRAPFRAME || t->n >= NVMA)
+    return 0;
+  if((v = vmanext(t, start)) != 0 && v->start < end)
+    return 0;
+  if((v = kmem_cache_alloc(vma.cache)) == 0)
+    return 0;
+  memset(v, 0, sizeof(*v));
+  v->start = start;
+  v->end = end;
+  v->prot = prot;
+  v->type = type;
+  v->height = 1;
+  t->root = insert(t->root, v);
+  t->n++;
+  return v;
+}
+
+static void
+freevma(struct vma *v)
+{
+  if(v->f)
+    fileclose(v->f);
+  kmem_cache_free(vma.cache, v);
+}
+
+static void
+clear(struct vma *v)
+{
+  if(v == 0)
+    return;
+  clear(v->left);
+  clear(v->right);
+  freevma(v);
+}
+
+// Forget all of t's regions, leaving their pages mapped.
+void
+vmaclear(struct vmatree *t)
+{
+  clear(t->root);
+  t->root = 0;
+  t->n = 0;
+}
+
+// Move the start of v up to start, keeping the file
+// offsets of the rest of it.
+static void
+trimstart(struct vma *v, uint64 start)
+{
+  uint64 d = start - v->start;
+
+  v->off += d;
+  v->filesz = v->filesz > d ? v->filesz - d : 0;
+  v->start = start;
+}
+
+// Remove [start, end), which must be page-aligned, from p's
+// address space: unmap its pages, writing back those of
+// shared file mappings, and shrink, split or drop the
+// regions it covers.
+// Returns 0, or -1 if out of memory, in which case nothing
+// has changed.
+int
+vmaremove(struct proc *p, uint64 start, uint64 end)
+{
+  struct vma *v, *hi = 0;
+  uint64 s, e;
+
+  if(start >= end)
+    return 0;
+
+  // get what can run out first: a region for the part
+  // above a hole, and page-table pages for unmapping part
+  // of a megapage or of a shared page-table page.
+  v = vmanext(&p->vmas, start);
+  if(v && v->start < start && v->end > end){
+    if(p->vmas.n >= NVMA || (hi = kmem_cache_alloc(vma.cache)) == 0)
+      return -1;
+  }
+  uvmbegin();
+  if(uvmcut(p->pagetable, start) != 0 || uvmcut(p->pagetable, end) != 0){
+    uvmend();
+    if(hi)
+      kmem_cache_free(vma.cache, hi);
+    return -1;
+  }
+
+  while((v = vmanext(&p->vmas, start)) != 0 && v->start < end){
+    s = v->start > start ? v->start : start;
+    e = v->end < end ? v->end : end;
+    if(v->type == VMA_FILE)
+      mmapunmap(p, v, s, e);
+    else
+      uvmunmap(p->pagetable, s, (e - s) / PGSIZE, 1);
+
+    if(s > v->start && e < v->end){
+      // punched a hole: v keeps the part below it.
+      *hi = *v;
+      hi->left = hi->right = 0;
+      hi->height = 1;
+      trimstart(hi, e);
+      if(hi->f)
+        filedup(hi->f);
+      v->end = s;
+      p->vmas.root = insert(p->vmas.root, hi);
+      p->vmas.n++;
+      break;
+    } else if(s == v->start && e == v->end){
+      p->vmas.root = delete(p->vmas.root, v);
+      p->vmas.n--;
+      freevma(v);
+    } else if(s == v->start){
+      trimstart(v, e);
+    } else {
+      v->end = s;
+    }
+  }
+  uvmend();
+  return 0;
+}
+
+// Make the heap of p, the region of zeros ending at
+// PGROUNDUP(oldsz), reach up to newsz, without allocating
+// any memory for it; fault() allocates each page when it
+// is first touched.
+// Returns 0, or -1 if that would run into another region
+// or the trapframe.
+int
+vmagrow(struct proc *p, uint64 oldsz, uint64 newsz)
+{
+  uint64 a = PGROUNDUP(oldsz), b = PGROUNDUP(newsz);
+  struct vma *v;
+
+  if(newsz < oldsz || b > TRAPFRAME)
+    return -1;
+  if(b == a)
+    return 0;
+  if((v = vmanext(&p->vmas, a)) != 0 && v->start < b)
+    return -1;
+  if(a > 0 && (v = vmalookup(&p->vmas, a - 1)) != 0 &&
+     v->type == VMA_ANON && v->end == a){
+    v->end = b;
+    return 0;
+  }
+  return vmaadd(&p->vmas, a, b, PROT_READ|PROT_WRITE, VMA_ANON) ? 0 : -1;
+}
+
+// Unmap p's mapped files, writing back dirty pages, and
+// forget all its regions, on exit or exec.
+void
+vmafree(struct proc *p)
+{
+  struct vma *v;
+
+  uvmbegin();
+  for(v = vmanext(&p->vmas, 0); v; v = vmanext(&p->vmas, v->end))
+    if(v->type == VMA_FILE)
+      mmapunmap(p, v, v->start, v->end);
+  uvmend();
+  vmaclear(&p->vmas);
+}
+
+// Give fork's child np copies of p's regions and of the
+// pages mapped in them. Pages of shared file mappings are
+// faulted in again from the page cache; the rest may have
+// been written, so they are shared copy-on-write, a run
+// of adjacent regions at a time (see uvmcopy()). Called
+// with np->lock held, so it must not sleep.
+// Returns 0 on success, -1 if out of memory.
+int
+vmadup(struct proc *p, struct proc *np)
+{
+  struct vma *v, *nv;
+  uint64 start = 0, end = 0;
+
+  for(v = vmanext(&p->vmas, 0); v; v = vmanext(&p->vmas, v->end)){
+    if((nv = vmaadd(&np->vmas, v->start, v->end, v->prot, v->type)) == 0)
+      goto bad;
+    nv->flags = v->flags;
+    nv->off = v->off;
+    nv->filesz = v->filesz;
+    if(v->f)
+      nv->f = filedup(v->f);
+    if(v->type == VMA_FILE && v->flags == MAP_SHARED)
+      continue;
+    if(v->start != end){
+      if(end > start && uvmcopy(p->pagetable, np->pagetable, start, end) != 0)
+        goto bad;
+      start = v->start;
+    }
+    end = v->end;
+  }
+  if(end > start && uvmcopy(p->pagetable, np->pagetable, start, end) != 0)
+    goto bad;
+  return 0;
+
+ bad:
+  // freeproc() frees whatever np's page table holds.
+  vmaclear(&np->vmas);
+  return -1;
+}
+
+// The PTE permissions for v's pages.
+int
+vmaperm(struct vma *v)
+{
+  int perm = PTE_U;
+
+  if(v->prot & PROT_READ)
+    perm |= PTE_R;
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+  return perm;
+}
@@ -0,0 +1,320 @@
+// Compressed in-memory swap.
+//
+// reclaim() (swap.c) first tries to page a page out to
+// memory, compressed: zram_store() compresses it with a
+// small LZ77 codec in the style of LZ4, and keeps the result
+// if it's at most ZMAX bytes. Pages that don't compress that
+// well go to the swap disk instead.
+//
+// Compressed pages are packed one after another into pool
+// pages. Each compressed page holds a reference (kref()) to
+// the pool page it is in, so a pool page goes back to kalloc()
+// when the last page in it is freed. Paging out happens when
+// memory has run out, so zram keeps a spare pool page for
+// when kalloc() fails; the page that was paged out refills it.
+//
+// A compressed page is named by its entry number, which
+// swap.c keeps in the page's PTE. Entries have reference
+// counts, since fork() shares paged-out pages.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "defs.h"
+#include "memstat.h"
+
+#define ZMAX (PGSIZE*3/4)   // largest compressed page kept
+
+#define MINMATCH 4
+#define HBITS 12            // log2 of the size of the match finder's table
+
+struct zentry {
+  char *data;     // compressed page, in a pool page; 0 if free
+  ushort len;
+  uchar ref;
+};
+
+struct {
+  struct spinlock lock;
+  struct zentry e[NZRAM];
+  int next;       // where to look for a free entry
+  char *cur;      // pool page being filled
+  int off;        // bytes of it used
+  char *spare;    // pool page for when kalloc() fails
+  uint64 npages;  // entries in use
+  uint64 nbytes;  // compressed bytes they hold
+  uint64 npool;   // pool pages
+} zram;
+
+// only one reclaim() at a time calls zram_store(), so the
+// compressor can use static buffers.
+static uchar zbuf[ZMAX];
+static ushort htab[1 << HBITS];
+
+void
+zraminit(void)
+{
+  initlock(&zram.lock, "zram");
+  zram.spare = kalloc();
+}
+
+static uint
+get32(uchar *p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint)p[3] << 24;
+}
+
+// append a length that didn't fit in a token's nibble.
+static int
+putlen(uchar *dst, int op, int max, int len)
+{
+  for(; len >= 255; len -= 255){
+    if(op >= max)
+      return -1;
+    dst[op++] = 255;
+  }
+  if(op >= max)
+    return -1;
+  dst[op++] = len;
+  return op;
+}
+
+// append a sequence: nlit literal bytes at lit, then a
+// match of mlen bytes at offset back (none if mlen is 0).
+// returns the new output length, or -1 if it exceeds max.
+static int
+putseq(uchar *dst, int op, int max, uchar *lit, int nlit, int off, int mlen)
+{
+  int ml = mlen > 0 ? mlen - MINMATCH : 0;
+
+  if(op >= max)
+    return -1;
+  dst[op++] = (nlit < 15 ? nlit : 15) << 4 | (ml < 15 ? ml : 15);
+  if(nlit >= 15 && (op = putlen(dst, op, max, nlit - 15)) < 0)
+    return -1;
+  if(op + nlit > max)
+    return -1;
+  memmove(dst + op, lit, nlit);
+  op += nlit;
+  if(mlen == 0)
+    return op;
+  if(op + 2 > max)
+    return -1;
+  dst[op++] = off;
+  dst[op++] = off >> 8;
+  if(ml >= 15 && (op = putlen(dst, op, max, ml - 15)) < 0)
+    return -1;
+  return op;
+}
+
+// compress the page at src into at most max bytes at dst.
+// returns the compressed length, or -1 if it doesn't fit.
+static int
+compress(uchar *src, uchar *dst, int max)
+{
+  int ip = 0, anchor = 0, op = 0, ref, len;
+  uint seq, h;
+
+  memset(htab, 0, sizeof(htab));
+  while(ip + MINMATCH <= PGSIZE){
+    seq = get32(src + ip);
+    h = (seq * 2654435761U) >> (32 - HBITS);
+    ref = htab[h];
+    htab[h] = ip;
+    if(ref >= ip || get32(src + ref) != seq){
+      ip++;
+      continue;
+    }
+    for(len = MINMATCH; ip + len < PGSIZE && src[ref + len] == src[ip + len]; len++)
+      ;
+    op = putseq(dst, op, max, src + anchor, ip - anchor, ip - ref, len);
+    if(op < 0)
+      return -1;
+    ip += len;
+    anchor = ip;
+  }
+  return putseq(dst, op, max, src + anchor, PGSIZE - anchor, 0, 0);
+}
+
+// read a length that didn't fit in a token's nibble.
+static int
+getlen(uchar *src, int *ip, int n, int len)
+{
+  int b;
+
+  do {
+    if(*ip >= n)
+      return -1;
+    b = src[(*ip)++];
+    len += b;
+  } while(b == 255);
+  return len;
+}
+
+// decompress n bytes at src into the page at dst.
+// returns 0, or -1 if the data is corrupt.
+static int
+decompress(uchar *src, int n, uchar *dst)
+{
+  int ip = 0, op = 0, token, len, off;
+
+  while(ip < n){
+    token = src[ip++];
+    len = token >> 4;
+    if(len == 15 && (len = getlen(src, &ip, n, len)) < 0)
+      return -1;
+    if(ip + len > n || op + len > PGSIZE)
+      return -1;
+    memmove(dst + op, src + ip, len);
+    ip += len;
+    op += len;
+    if(ip == n)
+      break;
+
+    if(ip + 2 > n)
+      return -1;
+    off = src[ip] | src[ip+1] << 8;
+    ip += 2;
+    len = token & 15;
+    if(len == 15 && (len = getlen(src, &ip, n, len)) < 0)
+      return -1;
+    len += MINMATCH;
+    if(off == 0 || off > op || op + len > PGSIZE)
+      return -1;
+    for(; len > 0; len--, op++)  // may overlap
+      dst[op] = dst[op - off];
+  }
+  return op == PGSIZE ? 0 : -1;
+}
+
+// drop zram's reference to pool page pg.
+// caller must hold zram.lock.
+static void
+putpool(char *pg)
+{
+  if(krefcnt(pg) == 1)
+    zram.npool--;
+  kfree(pg);
+}
+
+// Compress the page at pa into the pool.
+// Returns the new entry's number, or -1 if the page doesn't
+// compress well enough or there's no room.
+int
+zram_store(char *pa)
+{
+  struct zentry *e = 0;
+  char *pg;
+  int n, i;
+
+  if((n = compress((uchar*)pa, zbuf, ZMAX)) < 0)
+    return -1;
+
+  acquire(&zram.lock);
+  for(i = 0; i < NZRAM; i++){
+    e = &zram.e[(zram.next + i) % NZRAM];
+    if(e->data == 0)
+      break;
+  }
+  if(i == NZRAM)
+    goto fail;
+  i = e - zram.e;
+
+  if(zram.cur == 0 || zram.off + n > PGSIZE){
+    if((pg = kalloc()) == 0){
+      pg = zram.spare;
+      zram.spare = 0;
+    }
+    if(pg == 0)
+      goto fail;
+    if(zram.cur)
+      putpool(zram.cur);
+    zram.cur = pg;
+    zram.off = 0;
+    zram.npool++;
+  }
+
+  e->data = zram.cur + zram.off;
+  e->len = n;
+  e->ref = 1;
+  memmove(e->data, zbuf, n);
+  kref(zram.cur);
+  zram.off += n;
+  zram.next = i + 1;
+  zram.npages++;
+  zram.nbytes += n;
+  release(&zram.lock);
+  return i;
+
+ fail:
+  release(&zram.lock);
+  return -1;
+}
+
+// Decompress entry i into the page at pa.
+// The caller holds a reference to the entry.
+void
+zram_load(int i, char *pa)
+{
+  struct zentry *e = &zram.e[i];
+  char *data;
+  int n;
+
+  acquire(&zram.lock);
+  data = e->data;
+  n = e->len;
+  release(&zram.lock);
+  if(data == 0 || decompress((uchar*)data, n, (uchar*)pa) != 0)
+    panic("zram_load");
+}
+
+// Add a reference to entry i, for fork().
+void
+zram_dup(int i)
+{
+  acquire(&zram.lock);
+  if(zram.e[i].data == 0)
+    panic("zram_dup");
+  zram.e[i].ref++;
+  release(&zram.lock);
+}
+
+// Drop a reference to entry i, freeing it if that was
+// the last one.
+void
+zram_free(int i)
+{
+  struct zentry *e = &zram.e[i];
+
+  acquire(&zram.lock);
+  if(e->data == 0)
+    panic("zram_free");
+  if(--e->ref == 0){
+    putpool((char*)PGROUNDDOWN((uint64)e->data));
+    zram.npages--;
+    zram.nbytes -= e->len;
+    e->data = 0;
+  }
+  release(&zram.lock);
+}
+
+// Keep a spare pool page, if memory allows.
+void
+zram_refill(void)
+{
+  acquire(&zram.lock);
+  if(zram.spare == 0)
+    zram.spare = kalloc();
+  release(&zram.lock);
+}
+
+void
+zramstat(struct memstat *st)
+{
+  acquire(&zram.lock);
+  st->zrampages = zram.npages;
+  st->zrambytes = zram.nbytes;
+  st->zrampool = zram.npool;
+  release(&zram.lock);
+}
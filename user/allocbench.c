@@ -0,0 +1,88 @@
+//
+// page allocator throughput benchmark.
+// for 1..NCPU concurrent processes, each process repeatedly
+// grows its heap by NPAGE pages, touches every page, and
+// shrinks it again, for DURATION ticks. reports the total
+// number of pages allocated and freed per tick.
+// run with make CPUS=8 qemu to see scaling.
+//
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NPAGE    64
+#define DURATION 20  // ticks per run
+
+// allocate and free pages until ticks reaches deadline.
+// returns the number of pages allocated.
+int
+churn(int deadline)
+{
+  int n = 0;
+  char *a;
+
+  while(uptime() < deadline){
+    a = sbrk(NPAGE * 4096);
+    if(a == (char*)-1){
+      printf("allocbench: sbrk failed\n");
+      exit(1);
+    }
+    for(int i = 0; i < NPAGE; i++)
+      a[i * 4096] = 1;
+    sbrk(-NPAGE * 4096);
+    n += NPAGE;
+  }
+  return n;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int maxproc = NCPU;
+
+  if(argc > 1)
+    maxproc = atoi(argv[1]);
+  if(maxproc < 1 || maxproc > NCPU){
+    printf("usage: allocbench [nproc]\n");
+    exit(1);
+  }
+
+  for(int nproc = 1; nproc <= maxproc; nproc++){
+    int fds[2];
+    if(pipe(fds) < 0){
+      printf("allocbench: pipe failed\n");
+      exit(1);
+    }
+
+    // start all children at the same tick.
+    int start = uptime() + 2;
+    for(int i = 0; i < nproc; i++){
+      int pid = fork();
+      if(pid < 0){
+        printf("allocbench: fork failed\n");
+        exit(1);
+      }
+      if(pid == 0){
+        close(fds[0]);
+        while(uptime() < start)
+          ;
+        int n = churn(start + DURATION);
+        write(fds[1], &n, sizeof(n));
+        exit(0);
+      }
+    }
+    close(fds[1]);
+
+    int total = 0, n;
+    while(read(fds[0], &n, sizeof(n)) == sizeof(n))
+      total += n;
+    close(fds[0]);
+    for(int i = 0; i < nproc; i++)
+      wait(0);
+
+    printf("%d procs: %d pages/tick\n", nproc, total / DURATION);
+  }
+  exit(0);
+}
@@ -0,0 +1,45 @@
+//
+// print how much of the time each CPU spent idle, waiting
+// in wfi for something to do, over an interval and since
+// it started.
+//
+//   cpus       (over 10 ticks)
+//   cpus 50
+//
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/riscv.h"
+#include "kernel/cpustat.h"
+#include "user/user.h"
+
+struct cpustat before[NCPU], after[NCPU];
+
+int
+main(int argc, char *argv[])
+{
+  int ticks;
+  uint64 t0, t1;
+
+  ticks = argc > 1 ? atoi(argv[1]) : 10;
+  t0 = r_time();
+  if(cpustat(before) < 0){
+    fprintf(2, "cpus: cpustat failed\n");
+    exit(1);
+  }
+  sleep(ticks);
+  t1 = r_time();
+  cpustat(after);
+
+  for(int i = 0; i < NCPU; i++){
+    struct cpustat *a = &before[i], *b = &after[i];
+    if(a->started == 0)
+      continue;  // no such CPU, or it started meanwhile
+    printf("cpu %d: %d%% idle, %d%% since it started; idle %d times, "
+           "woken by %d IPIs\n", i,
+           (int)((b->idletime - a->idletime) * 100 / (t1 - t0)),
+           (int)(b->idletime * 100 / (t1 - b->started)),
+           (int)b->nidle, (int)b->nwake);
+  }
+  exit(0);
+}
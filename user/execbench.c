@@ -0,0 +1,78 @@
+//
+// exec benchmark.
+// times fork+exec+exit of some short-lived tools, with
+// their output discarded, then reports the memory used
+// by each of several concurrent processes running the
+// same program.
+//
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define N     50  // runs per tool
+#define NPROC 10  // concurrent processes
+
+char *tools[][3] = {
+  { "echo", "hello", 0 },
+  { "ls", ".", 0 },
+  { "wc", "README", 0 },
+  { "grep", "xv6", "README" },
+};
+
+// start NPROC cats reading from a pipe, and see how much
+// memory they use while blocked.
+void
+concurrent(void)
+{
+  char *args[] = { "cat", 0 };
+  int fds[2], before;
+
+  pipe(fds);
+  before = freepages();
+  for(int i = 0; i < NPROC; i++){
+    if(fork() == 0){
+      close(0);
+      dup(fds[0]);
+      close(fds[0]);
+      close(fds[1]);
+      exec(args[0], args);
+      exit(1);
+    }
+  }
+  sleep(10);
+  printf("%d concurrent cats: %d pages each\n", NPROC,
+         (before - freepages()) / NPROC);
+  close(fds[0]);
+  close(fds[1]);
+  for(int i = 0; i < NPROC; i++)
+    wait(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  for(int t = 0; t < sizeof(tools)/sizeof(tools[0]); t++){
+    char *args[4] = { tools[t][0], tools[t][1], tools[t][2], 0 };
+    int t0 = uptime();
+
+    for(int i = 0; i < N; i++){
+      int pid = fork();
+      if(pid < 0){
+        printf("execbench: fork failed\n");
+        exit(1);
+      }
+      if(pid == 0){
+        close(1);
+        open("execbench.out", O_CREATE|O_WRONLY|O_TRUNC);
+        exec(args[0], args);
+        exit(1);
+      }
+      wait(0);
+    }
+    printf("%s: %d runs, %d ticks\n", args[0], N, uptime() - t0);
+  }
+  unlink("execbench.out");
+  concurrent();
+  exit(0);
+}
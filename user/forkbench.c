@@ -0,0 +1,85 @@
+//
+// fork benchmark.
+// for a range of parent sizes, measures how long fork+exit
+// and fork+exec take, and how much memory a fork consumes.
+//
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define N 100  // forks per measurement
+
+// run N forks of a child that either exits or execs prog.
+// returns elapsed ticks.
+int
+run(char *prog)
+{
+  char *argv[] = { prog, "-x", 0 };
+  int t0 = uptime();
+
+  for(int i = 0; i < N; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("forkbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      if(prog)
+        exec(prog, argv);
+      exit(0);
+    }
+    wait(0);
+  }
+  return uptime() - t0;
+}
+
+// how many pages does one fork use, before the
+// child touches anything?
+int
+spike(void)
+{
+  int fds[2], before, after;
+
+  pipe(fds);
+  before = freepages();
+  int pid = fork();
+  if(pid == 0){
+    after = freepages();
+    write(fds[1], &after, sizeof(after));
+    exit(0);
+  }
+  read(fds[0], &after, sizeof(after));
+  wait(0);
+  close(fds[0]);
+  close(fds[1]);
+  return before - after;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int sizes[] = { 0, 1, 4, 16, 32 };  // MiB
+
+  if(argc > 1 && strcmp(argv[1], "-x") == 0)
+    exit(0);
+
+  printf("size  fork+exit  fork+exec  fork pages\n");
+  for(int i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++){
+    uint64 sz = (uint64)sizes[i] * 1024 * 1024;
+    char *a = sbrk(sz);
+    if(a == (char*)-1){
+      printf("forkbench: sbrk failed\n");
+      exit(1);
+    }
+    for(char *p = a; p < a + sz; p += PGSIZE)
+      *p = 1;
+
+    int tfork = run(0);
+    int texec = run(argv[0]);
+    int pages = spike();
+    printf("%dM    %d ticks    %d ticks    %d\n", sizes[i], tfork, texec, pages);
+    sbrk(-sz);
+  }
+  exit(0);
+}
@@ -0,0 +1,33 @@
+//
+// show same-page merging statistics, and set the
+// scan rate (pages per tick; 0 turns merging off).
+// usage: ksm [rate]
+//
+
+#include "kernel/types.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct memstat st;
+  int rate;
+
+  if(argc > 2){
+    fprintf(2, "usage: ksm [rate]\n");
+    exit(1);
+  }
+  if(argc == 2)
+    ksm(atoi(argv[1]));
+  rate = ksm(-1);
+  if(memstat(&st) < 0){
+    fprintf(2, "ksm: memstat failed\n");
+    exit(1);
+  }
+  printf("rate: %d pages per tick%s\n", rate, rate == 0 ? " (off)" : "");
+  printf("scanned: %d, merged: %d\n", (int)st.ksmscanned, (int)st.ksmmerged);
+  printf("merged pages: %d, saving %d KiB\n", (int)st.ksmpages,
+         (int)(st.ksmsaved / 1024));
+  exit(0);
+}
@@ -0,0 +1,83 @@
+//
+// kernel memory-bandwidth benchmark.
+// times two paths where the kernel sweeps through memory
+// via its direct map: allocating and freeing heap pages
+// (kalloc/kfree junk-fill and zeroing), and reading a
+// file that sits in the buffer cache (bio and copyout
+// memmove). compare runs on the default kernel, whose
+// direct map uses megapages, and one built with
+// make SMALLKVM=1, whose direct map uses 4 KiB pages.
+//
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define HEAP   (4*1024*1024)
+#define NROUND 20
+#define FSIZE  (16*1024)   // fits in the buffer cache
+#define NREAD  2000
+
+char buf[FSIZE];
+
+// grow the heap, touch every page, shrink it again.
+int
+pages(void)
+{
+  int t0 = uptime();
+
+  for(int r = 0; r < NROUND; r++){
+    char *a = sbrk(HEAP);
+    if(a == (char*)-1){
+      printf("kvmbench: sbrk failed\n");
+      exit(1);
+    }
+    for(char *p = a; p < a + HEAP; p += PGSIZE)
+      *p = 1;
+    sbrk(-HEAP);
+  }
+  return uptime() - t0;
+}
+
+// re-read a small file many times.
+int
+reads(void)
+{
+  int fd, t0;
+
+  if((fd = open("kvmbench.tmp", O_CREATE|O_RDWR)) < 0){
+    printf("kvmbench: create failed\n");
+    exit(1);
+  }
+  if(write(fd, buf, FSIZE) != FSIZE){
+    printf("kvmbench: write failed\n");
+    exit(1);
+  }
+  close(fd);
+
+  t0 = uptime();
+  for(int i = 0; i < NREAD; i++){
+    if((fd = open("kvmbench.tmp", O_RDONLY)) < 0 ||
+       read(fd, buf, FSIZE) != FSIZE){
+      printf("kvmbench: read failed\n");
+      exit(1);
+    }
+    close(fd);
+  }
+  t0 = uptime() - t0;
+  unlink("kvmbench.tmp");
+  return t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int t;
+
+  t = pages();
+  printf("alloc/free %d MiB: %d ticks\n", NROUND * (HEAP/(1024*1024)), t);
+  t = reads();
+  printf("cached read %d KiB: %d ticks\n", NREAD * (FSIZE/1024), t);
+  exit(0);
+}
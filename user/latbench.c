@@ -0,0 +1,104 @@
+//
+// response time benchmark.
+// a process that mostly sleeps wakes up at intervals and is
+// sent a message, while CPU-bound processes keep all the
+// CPUs busy. measures how long after each message is sent
+// the sleeper gets to run and read it, and prints
+// percentiles, first with the CPU-bound processes at the
+// default priority, then with them started by nice.
+//
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define NSPIN   8    // CPU-bound processes
+#define NSAMPLE 100  // messages
+#define US (TIMEBASE / 1000000)  // time CSR cycles per microsecond
+
+uint64 lat[NSAMPLE];
+
+void
+sort(uint64 *a, int n)
+{
+  for(int i = 1; i < n; i++){
+    uint64 x = a[i];
+    int j;
+    for(j = i; j > 0 && a[j-1] > x; j--)
+      a[j] = a[j-1];
+    a[j] = x;
+  }
+}
+
+// start NSPIN processes that spin at base level nice.
+void
+spinners(int *pids, int nice)
+{
+  for(int i = 0; i < NSPIN; i++){
+    if((pids[i] = fork()) < 0){
+      printf("latbench: fork failed\n");
+      exit(1);
+    }
+    if(pids[i] == 0){
+      setpriority(0, nice);
+      for(;;)
+        ;
+    }
+  }
+}
+
+void
+run(int nice)
+{
+  int pids[NSPIN], p[2], pid;
+  uint64 t;
+
+  if(pipe(p) < 0){
+    printf("latbench: pipe failed\n");
+    exit(1);
+  }
+  spinners(pids, nice);
+
+  // the sleeper reads the time each message was sent.
+  pid = fork();
+  if(pid < 0){
+    printf("latbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(p[1]);
+    for(int i = 0; i < NSAMPLE; i++){
+      if(read(p[0], &t, sizeof(t)) != sizeof(t))
+        exit(1);
+      lat[i] = r_time() - t;
+    }
+    sort(lat, NSAMPLE);
+    printf("spinners at level %d: response time p50 %d us, p90 %d us, "
+           "p99 %d us, max %d us\n", nice,
+           (int)(lat[NSAMPLE/2] / US), (int)(lat[NSAMPLE*9/10] / US),
+           (int)(lat[NSAMPLE*99/100] / US), (int)(lat[NSAMPLE-1] / US));
+    exit(0);
+  }
+  close(p[0]);
+
+  for(int i = 0; i < NSAMPLE; i++){
+    sleep(1);
+    t = r_time();
+    write(p[1], &t, sizeof(t));
+  }
+  close(p[1]);
+  wait(0);
+  for(int i = 0; i < NSPIN; i++){
+    kill(pids[i]);
+    wait(0);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  run(0);
+  run(NPRIO-1);
+  exit(0);
+}
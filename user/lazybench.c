@@ -0,0 +1,46 @@
+//
+// lazy heap allocation benchmark.
+// reserves a 64 MiB heap with sbrk(), touches 1% of its
+// pages, and reports how much physical memory that used
+// and how long it took.
+//
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define HEAP  (64*1024*1024)
+#define NPAGE (HEAP/PGSIZE)
+
+int
+main(int argc, char *argv[])
+{
+  int free0, free1, free2, t0, t1, t2, touched = 0;
+  char *a;
+
+  free0 = freepages();
+  t0 = uptime();
+  a = sbrk(HEAP);
+  if(a == (char*)-1){
+    printf("lazybench: sbrk failed\n");
+    exit(1);
+  }
+  t1 = uptime();
+  free1 = freepages();
+
+  // touch every 100th page.
+  for(int i = 0; i < NPAGE; i += 100){
+    a[(uint64)i * PGSIZE] = 1;
+    touched++;
+  }
+  t2 = uptime();
+  free2 = freepages();
+
+  printf("sbrk(%d MiB): %d pages, %d ticks\n", HEAP/(1024*1024),
+         free0 - free1, t1 - t0);
+  printf("touched %d of %d pages: %d pages, %d ticks\n", touched, NPAGE,
+         free1 - free2, t2 - t1);
+  printf("resident: %d pages, eager allocation would use %d\n",
+         free0 - free2, NPAGE);
+  exit(0);
+}
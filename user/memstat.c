@@ -0,0 +1,65 @@
+//
+// print physical memory allocator statistics.
+//
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+// qemu's time CSR counts at 10 MHz.
+#define NSPERTICK 100
+
+int
+main(int argc, char *argv[])
+{
+  struct memstat st;
+
+  if(memstat(&st) < 0){
+    fprintf(2, "memstat: failed\n");
+    exit(1);
+  }
+
+  printf("free pages: %d (%d in per-CPU caches, %d zeroed)\n",
+         (int)st.freepages, (int)st.cachedpages, (int)st.zeroedpages);
+  printf("user megapages mapped: %d\n", (int)st.megapages);
+  printf("paged out: %d, paged in: %d\n", (int)st.swapouts, (int)st.swapins);
+  printf("  zero pages: %d\n", (int)st.zeropages);
+  printf("  compressed: %d pages in %d bytes (%d pool pages)",
+         (int)st.zrampages, (int)st.zrambytes, (int)st.zrampool);
+  if(st.zrambytes > 0){
+    int r = st.zrampages * PGSIZE * 10 / st.zrambytes;
+    printf(", ratio %d.%d:1", r / 10, r % 10);
+  }
+  printf("\n");
+  printf("  swap disk: %d of %d pages used\n", (int)st.swapused, (int)st.swapslots);
+  if(st.zramins > 0)
+    printf("  decompressing faults: %d, avg %d ns\n", (int)st.zramins,
+           (int)(st.zramintime * NSPERTICK / st.zramins));
+  if(st.diskins > 0)
+    printf("  swap disk faults: %d, avg %d ns\n", (int)st.diskins,
+           (int)(st.diskintime * NSPERTICK / st.diskins));
+  printf("same-page merging: %d scanned, %d merged, %d shared pages save %d KiB\n",
+         (int)st.ksmscanned, (int)st.ksmmerged, (int)st.ksmpages,
+         (int)(st.ksmsaved / 1024));
+
+  // the fraction of free memory that can't be used for a
+  // block of a given order, because it is split into smaller
+  // free blocks.
+  printf("order  free blocks  unusable%%  allocs  fails  avg ns  max ns\n");
+  for(int k = 0; k < NORDER; k++){
+    uint64 usable = k == 0 ? st.cachedpages + st.zeroedpages : 0;
+    for(int j = k; j < NORDER; j++)
+      usable += st.nfree[j] << j;
+    int unusable = 0;
+    if(st.freepages > 0)
+      unusable = 100 - (int)(usable * 100 / st.freepages);
+    int avg = 0;
+    if(st.nalloc[k] > 0)
+      avg = (int)(st.alloctime[k] * NSPERTICK / st.nalloc[k]);
+    printf("%d      %d          %d         %d     %d     %d     %d\n",
+           k, (int)st.nfree[k], unusable, (int)st.nalloc[k],
+           (int)st.nfail[k], avg, (int)(st.maxalloctime[k] * NSPERTICK));
+  }
+  exit(0);
+}
@@ -0,0 +1,84 @@
+//
+// mmap benchmark.
+// scans a large file repeatedly, once with read() and once
+// through a shared mapping, and reports how long each took
+// and how much memory a second process mapping the same
+// file uses.
+//
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define FSIZE  (256*1024)  // nearly the largest xv6 file
+#define NSCAN  20
+
+char buf[BSIZE];
+
+int
+main(int argc, char *argv[])
+{
+  int fd, t0, t1, fds[2], before, after;
+  uint sum = 0;
+  char *a;
+
+  fd = open("mmapbench.tmp", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("mmapbench: create failed\n");
+    exit(1);
+  }
+  for(int i = 0; i < FSIZE; i += BSIZE){
+    memset(buf, i / BSIZE, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("mmapbench: write failed\n");
+      exit(1);
+    }
+  }
+  close(fd);
+
+  t0 = uptime();
+  for(int n = 0; n < NSCAN; n++){
+    fd = open("mmapbench.tmp", O_RDONLY);
+    while(read(fd, buf, BSIZE) == BSIZE)
+      sum += buf[0];
+    close(fd);
+  }
+  t1 = uptime();
+  printf("read() %d x %d KiB: %d ticks\n", NSCAN, FSIZE/1024, t1 - t0);
+
+  fd = open("mmapbench.tmp", O_RDONLY);
+  a = mmap(0, FSIZE, PROT_READ, MAP_SHARED, fd, 0);
+  if(a == (char*)-1){
+    printf("mmapbench: mmap failed\n");
+    exit(1);
+  }
+  t0 = uptime();
+  for(int n = 0; n < NSCAN; n++)
+    for(int i = 0; i < FSIZE; i += BSIZE)
+      sum += a[i];
+  t1 = uptime();
+  printf("mmap %d x %d KiB: %d ticks\n", NSCAN, FSIZE/1024, t1 - t0);
+
+  // a child mapping the same file should share its pages.
+  pipe(fds);
+  before = freepages();
+  if(fork() == 0){
+    char *b = mmap(0, FSIZE, PROT_READ, MAP_SHARED, fd, 0);
+    for(int i = 0; i < FSIZE; i += PGSIZE)
+      sum += b[i];
+    after = freepages();
+    write(fds[1], &after, sizeof(after));
+    exit(0);
+  }
+  read(fds[0], &after, sizeof(after));
+  wait(0);
+  printf("second mapping: %d pages for %d pages of file (sum %d)\n",
+         before - after, FSIZE/PGSIZE, sum);
+
+  munmap(a, FSIZE);
+  close(fd);
+  unlink("mmapbench.tmp");
+  exit(0);
+}
@@ -0,0 +1,24 @@
+//
+// run a command at a lower scheduling priority.
+// level 0 is the highest, and the default; 3 is the lowest.
+// usage: nice level command [args...]
+//
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  if(argc < 3){
+    fprintf(2, "usage: nice level command [args...]\n");
+    exit(1);
+  }
+  if(setpriority(0, atoi(argv[1])) < 0){
+    fprintf(2, "nice: bad level %s\n", argv[1]);
+    exit(1);
+  }
+  exec(argv[2], argv + 2);
+  fprintf(2, "nice: exec %s failed\n", argv[2]);
+  exit(1);
+}
@@ -0,0 +1,94 @@
+//
+// scheduling latency benchmark.
+// fills the process table with processes that sleep, then
+// times pipe round trips between two processes: each trip
+// takes two wakeups and two scheduling decisions, so it
+// shows how their cost grows with the number of processes.
+//
+//   schedbench 64
+//   schedbench 1024    (in a kernel built with make NPROC=1024)
+//
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define NTRIP 10000  // pipe round trips
+
+// time NTRIP round trips to a child over a pair of pipes.
+// returns elapsed ticks.
+int
+roundtrips(void)
+{
+  int t0, pid, a[2], b[2];
+  char c = 0;
+
+  if(pipe(a) < 0 || pipe(b) < 0){
+    printf("schedbench: pipe failed\n");
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("schedbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    for(int i = 0; i < NTRIP; i++){
+      if(read(a[0], &c, 1) != 1)
+        exit(1);
+      write(b[1], &c, 1);
+    }
+    exit(0);
+  }
+  t0 = uptime();
+  for(int i = 0; i < NTRIP; i++){
+    write(a[1], &c, 1);
+    if(read(b[0], &c, 1) != 1){
+      printf("schedbench: read failed\n");
+      exit(1);
+    }
+  }
+  t0 = uptime() - t0;
+  wait(0);
+  close(a[0]);
+  close(a[1]);
+  close(b[0]);
+  close(b[1]);
+  return t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, nsleep, p[2];
+  char c;
+
+  n = argc > 1 ? atoi(argv[1]) : 64;
+  printf("%d round trips, alone: %d ticks\n", NTRIP, roundtrips());
+
+  // init, the shell, this process and its partner in the
+  // round trips make four; the rest sleep, reading a pipe
+  // that nothing is written to.
+  if(pipe(p) < 0){
+    printf("schedbench: pipe failed\n");
+    exit(1);
+  }
+  for(nsleep = 0; nsleep < n - 4; nsleep++){
+    int pid = fork();
+    if(pid < 0)
+      break;
+    if(pid == 0){
+      close(p[1]);
+      read(p[0], &c, 1);
+      exit(0);
+    }
+  }
+  printf("%d round trips, %d processes: %d ticks\n", NTRIP, nsleep + 4,
+         roundtrips());
+
+  // wake the sleepers with end-of-file.
+  close(p[0]);
+  close(p[1]);
+  while(nsleep-- > 0)
+    wait(0);
+  exit(0);
+}
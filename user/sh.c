@@ -3,6 +3,7 @@
 #include "kernel/types.h"
 #include "user/user.h"
 #include "kernel/fcntl.h"
+#include "kernel/spawn.h"
 
 // Parsed command representation
 #define EXEC  1
@@ -51,9 +52,13 @@ struct backcmd {
 
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
+void syntax(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
 void runcmd(struct cmd*) __attribute__((noreturn));
 
+int parseerr;  // set by syntax()
+
 // Execute cmd.  Never returns.
 void
 runcmd(struct cmd *cmd)
@@ -131,6 +136,85 @@ runcmd(struct cmd *cmd)
   exit(0);
 }
 
+// Can spawncmd() run cmd, with n file descriptor actions
+// already in the list? Only if it's simple commands,
+// redirected or joined by pipes, and the actions for them
+// and the end of the list fit in SPAWN_MAX.
+int
+spawnable(struct cmd *cmd, int n)
+{
+  if(cmd == 0 || n >= SPAWN_MAX)
+    return 0;
+  switch(cmd->type){
+  case EXEC:
+    return 1;
+  case REDIR:
+    return spawnable(((struct redircmd*)cmd)->cmd, n+2);
+  case PIPE:
+    return spawnable(((struct pipecmd*)cmd)->left, n+3) &&
+           spawnable(((struct pipecmd*)cmd)->right, n+3);
+  }
+  return 0;
+}
+
+// Start the programs of cmd with spawn(), so that the shell
+// never copies itself to run a command. fa holds n file
+// descriptor actions for them, from enclosing redirections
+// and pipes. spawnable(cmd, n) must be true.
+// Returns the number of processes started.
+int
+spawncmd(struct cmd *cmd, struct spawnfd *fa, int n)
+{
+  int p[2], fd, nproc;
+  struct execcmd *ecmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  switch(cmd->type){
+  default:
+    panic("spawncmd");
+
+  case EXEC:
+    ecmd = (struct execcmd*)cmd;
+    if(ecmd->argv[0] == 0)
+      return 0;
+    fa[n].op = SPAWN_END;
+    if(spawn(ecmd->argv[0], ecmd->argv, fa) < 0){
+      fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+      return 0;
+    }
+    return 1;
+
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    if((fd = open(rcmd->file, rcmd->mode)) < 0){
+      fprintf(2, "open %s failed\n", rcmd->file);
+      return 0;
+    }
+    fa[n++] = (struct spawnfd){ SPAWN_DUP, rcmd->fd, fd };
+    fa[n++] = (struct spawnfd){ SPAWN_CLOSE, fd, 0 };
+    nproc = spawncmd(rcmd->cmd, fa, n);
+    close(fd);
+    return nproc;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    if(pipe(p) < 0){
+      fprintf(2, "pipe failed\n");
+      return 0;
+    }
+    fa[n] = (struct spawnfd){ SPAWN_DUP, 1, p[1] };
+    fa[n+1] = (struct spawnfd){ SPAWN_CLOSE, p[0], 0 };
+    fa[n+2] = (struct spawnfd){ SPAWN_CLOSE, p[1], 0 };
+    nproc = spawncmd(pcmd->left, fa, n+3);
+    fa[n] = (struct spawnfd){ SPAWN_DUP, 0, p[0] };
+    nproc += spawncmd(pcmd->right, fa, n+3);
+    close(p[0]);
+    close(p[1]);
+    return nproc;
+  }
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -146,7 +230,9 @@ int
 main(void)
 {
   static char buf[100];
-  int fd;
+  struct spawnfd fa[SPAWN_MAX];
+  struct cmd *cmd;
+  int fd, n;
 
   // Ensure that three file descriptors are open.
   while((fd = open("console", O_RDWR)) >= 0){
@@ -165,9 +251,19 @@ main(void)
         fprintf(2, "cannot cd %s\n", buf+3);
       continue;
     }
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
-    wait(0);
+    parseerr = 0;
+    cmd = parsecmd(buf);
+    if(parseerr){
+      // nothing to run.
+    } else if(spawnable(cmd, 0)){
+      for(n = spawncmd(cmd, fa, 0); n > 0; n--)
+        wait(0);
+    } else {
+      if(fork1() == 0)
+        runcmd(cmd);
+      wait(0);
+    }
+    freecmd(cmd);
   }
   exit(0);
 }
@@ -179,6 +275,16 @@ panic(char *s)
   exit(1);
 }
 
+// Report a syntax error. The shell parses commands itself,
+// so it mustn't exit; the parser stops, and main() runs nothing.
+void
+syntax(char *s)
+{
+  if(!parseerr)
+    fprintf(2, "%s\n", s);
+  parseerr = 1;
+}
+
 int
 fork1(void)
 {
@@ -334,9 +440,9 @@ parsecmd(char *s)
   es = s + strlen(s);
   cmd = parseline(&s, es);
   peek(&s, es, "");
-  if(s != es){
+  if(s != es && !parseerr){
     fprintf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    syntax("syntax");
   }
   nulterminate(cmd);
   return cmd;
@@ -380,8 +486,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
-    if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if(gettoken(ps, es, &q, &eq) != 'a'){
+      syntax("missing file for redirection");
+      break;
+    }
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -406,8 +514,10 @@ parseblock(char **ps, char *es)
     panic("parseblock");
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
-  if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+  if(!peek(ps, es, ")")){
+    syntax("syntax - missing )");
+    return cmd;
+  }
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -432,13 +542,17 @@ parseexec(char **ps, char *es)
   while(!peek(ps, es, "|)&;")){
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if(tok != 'a')
-      panic("syntax");
+    if(tok != 'a'){
+      syntax("syntax");
+      break;
+    }
+    if(argc >= MAXARGS-1){
+      syntax("too many args");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
@@ -492,3 +606,41 @@ nulterminate(struct cmd *cmd)
   }
   return cmd;
 }
+
+// Free the parsed command cmd.
+void
+freecmd(struct cmd *cmd)
+{
+  struct backcmd *bcmd;
+  struct listcmd *lcmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  if(cmd == 0)
+    return;
+
+  switch(cmd->type){
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    freecmd(rcmd->cmd);
+    break;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    freecmd(pcmd->left);
+    freecmd(pcmd->right);
+    break;
+
+  case LIST:
+    lcmd = (struct listcmd*)cmd;
+    freecmd(lcmd->left);
+    freecmd(lcmd->right);
+    break;
+
+  case BACK:
+    bcmd = (struct backcmd*)cmd;
+    freecmd(bcmd->cmd);
+    break;
+  }
+  free(cmd);
+}
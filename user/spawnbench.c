@@ -0,0 +1,69 @@
+//
+// command launch benchmark.
+// for a range of parent sizes, measures how long it takes
+// to start a program and wait for it, with fork+exec (as
+// the shell used to) and with spawn().
+//
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define N 100  // launches per measurement
+
+// run N launches of prog, which exits at once.
+// returns elapsed ticks.
+int
+run(char *prog, int usespawn)
+{
+  char *argv[] = { prog, "-x", 0 };
+  int t0 = uptime();
+
+  for(int i = 0; i < N; i++){
+    if(usespawn){
+      if(spawn(prog, argv, 0) < 0){
+        printf("spawnbench: spawn failed\n");
+        exit(1);
+      }
+    } else {
+      int pid = fork();
+      if(pid < 0){
+        printf("spawnbench: fork failed\n");
+        exit(1);
+      }
+      if(pid == 0){
+        exec(prog, argv);
+        exit(1);
+      }
+    }
+    wait(0);
+  }
+  return uptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int sizes[] = { 0, 1, 4, 16 };  // MiB
+
+  if(argc > 1 && strcmp(argv[1], "-x") == 0)
+    exit(0);
+
+  printf("size  fork+exec  spawn\n");
+  for(int i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++){
+    uint64 sz = (uint64)sizes[i] * 1024 * 1024;
+    char *a = sbrk(sz);
+    if(a == (char*)-1){
+      printf("spawnbench: sbrk failed\n");
+      exit(1);
+    }
+    for(char *p = a; p < a + sz; p += PGSIZE)
+      *p = 1;
+
+    int tfork = run(argv[0], 0);
+    int tspawn = run(argv[0], 1);
+    printf("%dM    %d ticks    %d ticks\n", sizes[i], tfork, tspawn);
+    sbrk(-sz);
+  }
+  exit(0);
+}
@@ -0,0 +1,135 @@
+//
+// memmove(), memset() and memcmp() benchmark.
+// times each on sizes from 8 bytes to 64 KiB, with the
+// destination and source at various offsets from word
+// alignment, next to a byte-at-a-time copy for comparison.
+// each timing covers TOTAL bytes in all.
+// then times the kernel's memset() and memmove() on whole
+// pages: zero-filling new sbrk() memory, and copying pages
+// on copy-on-write faults after fork().
+//
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define TOTAL (8*1024*1024)
+#define MAXSZ (64*1024)
+
+char dbuf[MAXSZ + 8];
+char sbuf[MAXSZ + 8];
+
+int sizes[] = { 8, 64, 512, 4096, MAXSZ };
+int offs[][2] = { { 0, 0 }, { 3, 3 }, { 0, 5 }, { 5, 2 } };  // dst, src
+
+// touch each page of TOTAL bytes of new memory, which the
+// kernel zero-fills, and let it go again. returns ticks.
+int
+kzero(void)
+{
+  char *m;
+  int t0;
+
+  t0 = uptime();
+  if((m = sbrk(TOTAL)) == (char*)-1){
+    printf("strbench: sbrk failed\n");
+    exit(1);
+  }
+  for(int i = 0; i < TOTAL; i += 4096)
+    m[i] = 1;
+  sbrk(-TOTAL);
+  return uptime() - t0;
+}
+
+// fork with TOTAL bytes of memory, and have the child write
+// to each page, which the kernel copies. returns ticks.
+int
+kcopy(void)
+{
+  char *m;
+  int pid, xstatus, t0;
+
+  if((m = sbrk(TOTAL)) == (char*)-1){
+    printf("strbench: sbrk failed\n");
+    exit(1);
+  }
+  for(int i = 0; i < TOTAL; i += 4096)
+    m[i] = 1;
+  t0 = uptime();
+  if((pid = fork()) < 0){
+    printf("strbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    for(int i = 0; i < TOTAL; i += 4096)
+      m[i] = 2;
+    exit(0);
+  }
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("strbench: child failed\n");
+    exit(1);
+  }
+  t0 = uptime() - t0;
+  sbrk(-TOTAL);
+  return t0;
+}
+
+// copy a byte at a time, as memmove() used to.
+void
+bytecopy(char *dst, const char *src, int n)
+{
+  while(n-- > 0)
+    *dst++ = *src++;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, iters, t0, t[4];
+  char *d, *s;
+  volatile int r = 0;
+
+  memset(sbuf, 'x', sizeof(sbuf));
+  memset(dbuf, 'x', sizeof(dbuf));
+  printf("ticks for %d bytes\n", TOTAL);
+  printf("size\tdst+src\tmemmove\tmemset\tmemcmp\tbytes\n");
+  for(int i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++){
+    n = sizes[i];
+    iters = TOTAL / n;
+    for(int j = 0; j < sizeof(offs)/sizeof(offs[0]); j++){
+      d = dbuf + offs[j][0];
+      s = sbuf + offs[j][1];
+
+      t0 = uptime();
+      for(int k = 0; k < iters; k++)
+        memmove(d, s, n);
+      t[0] = uptime() - t0;
+
+      t0 = uptime();
+      for(int k = 0; k < iters; k++)
+        memset(d, 'x', n);
+      t[1] = uptime() - t0;
+
+      // equal buffers, so memcmp() reads all n bytes.
+      t0 = uptime();
+      for(int k = 0; k < iters; k++)
+        r += memcmp(d, s, n);
+      t[2] = uptime() - t0;
+
+      t0 = uptime();
+      for(int k = 0; k < iters; k++)
+        bytecopy(d, s, n);
+      t[3] = uptime() - t0;
+
+      printf("%d\t+%d+%d\t%d\t%d\t%d\t%d\n", n, offs[j][0], offs[j][1],
+             t[0], t[1], t[2], t[3]);
+    }
+  }
+  if(r != 0){
+    printf("strbench: memcmp of equal buffers failed\n");
+    exit(1);
+  }
+
+  printf("kernel\tzero\tcow\n");
+  printf("4096\t%d\t%d\n", kzero(), kcopy());
+  exit(0);
+}
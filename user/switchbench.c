@@ -0,0 +1,72 @@
+//
+// system call and context switch benchmark.
+// times getpid() round trips, and pipe round trips between
+// two processes, with each process touching a working set
+// of pages in between, so that the timings include the
+// TLB misses that follow each switch of page table.
+//
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define NCALL  100000  // getpid() calls
+#define NTRIP  10000   // pipe round trips
+#define NPAGE  32      // working set, in pages
+
+char ws[NPAGE*PGSIZE];
+
+// touch one word in each page of the working set.
+void
+touch(void)
+{
+  for(char *p = ws; p < ws + sizeof(ws); p += PGSIZE)
+    (*p)++;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int t0, pid, a[2], b[2];
+  char c = 0;
+
+  touch();
+  t0 = uptime();
+  for(int i = 0; i < NCALL; i++){
+    getpid();
+    touch();
+  }
+  printf("%d getpid() calls: %d ticks\n", NCALL, uptime() - t0);
+
+  if(pipe(a) < 0 || pipe(b) < 0){
+    printf("switchbench: pipe failed\n");
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("switchbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    touch();
+    for(int i = 0; i < NTRIP; i++){
+      if(read(a[0], &c, 1) != 1)
+        exit(1);
+      touch();
+      write(b[1], &c, 1);
+    }
+    exit(0);
+  }
+  t0 = uptime();
+  for(int i = 0; i < NTRIP; i++){
+    write(a[1], &c, 1);
+    if(read(b[0], &c, 1) != 1){
+      printf("switchbench: read failed\n");
+      exit(1);
+    }
+    touch();
+  }
+  printf("%d pipe round trips: %d ticks\n", NTRIP, uptime() - t0);
+  wait(0);
+  exit(0);
+}
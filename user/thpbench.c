@@ -0,0 +1,47 @@
+//
+// transparent huge page benchmark.
+// fills a megapage-aligned 16 MiB heap array, then times
+// passes that touch one word per page, which miss in the
+// TLB unless the kernel moved the array into megapages.
+// also reports how many pages the array and its page
+// tables use.
+//
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define SIZE  (16*1024*1024)
+#define NPASS 200
+
+int
+main(int argc, char *argv[])
+{
+  uint64 top, pad, sum = 0;
+  int free0, t0, t1;
+  char *a, *p;
+
+  top = (uint64)sbrk(0);
+  pad = (MEGAPGSIZE - top % MEGAPGSIZE) % MEGAPGSIZE;
+  free0 = freepages();
+  if(sbrk(pad + SIZE) == (char*)-1){
+    printf("thpbench: sbrk failed\n");
+    exit(1);
+  }
+  a = (char*)(top + pad);
+
+  t0 = uptime();
+  for(p = a; p < a + SIZE; p += PGSIZE)
+    *p = 1;
+  t1 = uptime();
+  printf("fill %d MiB: %d ticks, %d pages used\n", SIZE/(1024*1024),
+         t1 - t0, free0 - freepages());
+
+  t0 = uptime();
+  for(int i = 0; i < NPASS; i++)
+    for(p = a; p < a + SIZE; p += PGSIZE)
+      sum += *p;
+  t1 = uptime();
+  printf("%d strided passes: %d ticks (sum %d)\n", NPASS, t1 - t0, (int)sum);
+  exit(0);
+}
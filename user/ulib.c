@@ -1,6 +1,7 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/memstat.h"
 #include "user/user.h"
 
 //
@@ -43,14 +44,23 @@ strlen(const char *s)
   return n;
 }
 
+// memset(), memmove() and memcmp() work a word at a time
+// where the alignment allows.
+#define ALIGNED(p) (((uint64)(p) & 7) == 0)
+
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
-  }
+  uint64 w;
+
+  for(; n > 0 && !ALIGNED(cdst); n--)
+    *cdst++ = c;
+  w = (uchar)c * 0x0101010101010101UL;
+  for(; n >= 8; n -= 8, cdst += 8)
+    *(uint64*)cdst = w;
+  for(; n > 0; n--)
+    *cdst++ = c;
   return dst;
 }
 
@@ -95,6 +105,17 @@ stat(const char *n, struct stat *st)
   return r;
 }
 
+// the number of free physical pages, or -1.
+int
+freepages(void)
+{
+  struct memstat st;
+
+  if(memstat(&st) < 0)
+    return -1;
+  return st.freepages;
+}
+
 int
 atoi(const char *s)
 {
@@ -111,15 +132,43 @@ memmove(void *vdst, const void *vsrc, int n)
 {
   char *dst;
   const char *src;
+  const uint64 *wsrc;
+  uint64 lo, hi;
+  int shift;
 
   dst = vdst;
   src = vsrc;
   if (src > dst) {
+    for(; n > 0 && !ALIGNED(dst); n--)
+      *dst++ = *src++;
+    if(n >= 8 && ALIGNED(src)){
+      for(; n >= 8; n -= 8, dst += 8, src += 8)
+        *(uint64*)dst = *(const uint64*)src;
+    } else if(n >= 8){
+      // read aligned words and shift them together.
+      shift = ((uint64)src & 7) * 8;
+      wsrc = (const uint64*)((uint64)src & ~7L);
+      lo = *wsrc++;
+      for(; n >= 8; n -= 8, dst += 8, src += 8){
+        hi = *wsrc++;
+        *(uint64*)dst = lo >> shift | hi << (64 - shift);
+        lo = hi;
+      }
+    }
     while(n-- > 0)
       *dst++ = *src++;
   } else {
     dst += n;
     src += n;
+    if(((uint64)dst & 7) == ((uint64)src & 7)){
+      for(; n > 0 && !ALIGNED(dst); n--)
+        *--dst = *--src;
+      for(; n >= 8; n -= 8){
+        dst -= 8;
+        src -= 8;
+        *(uint64*)dst = *(const uint64*)src;
+      }
+    }
     while(n-- > 0)
       *--dst = *--src;
   }
@@ -130,6 +179,14 @@ int
 memcmp(const void *s1, const void *s2, uint n)
 {
   const char *p1 = s1, *p2 = s2;
+  if(((uint64)p1 & 7) == ((uint64)p2 & 7)){
+    for(; n > 0 && !ALIGNED(p1); n--, p1++, p2++)
+      if(*p1 != *p2)
+        return *p1 - *p2;
+    // skip equal words; the bytes find the difference.
+    for(; n >= 8 && *(uint64*)p1 == *(uint64*)p2; n -= 8)
+      p1 += 8, p2 += 8;
+  }
   while (n-- > 0) {
     if (*p1 != *p2) {
       return *p1 - *p2;
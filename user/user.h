@@ -1,4 +1,7 @@
 struct stat;
+struct memstat;
+struct cpustat;
+struct spawnfd;
 
 // system calls
 int fork(void);
@@ -22,9 +25,19 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int memstat(struct memstat*);
+void* mmap(void*, uint64, int, int, int, uint64);
+int munmap(void*, uint64);
+int ksm(int);
+int spawn(const char*, char**, struct spawnfd*);
+int setpriority(int, int);
+int setweight(int, int);
+int cpustat(struct cpustat*);
+int nanosleep(uint64);
 
 // ulib.c
 int stat(const char*, struct stat*);
+int freepages(void);
 char* strcpy(char*, const char*);
 void *memmove(void*, const void*, int);
 char* strchr(const char*, char c);
@@ -7,6 +7,9 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/memstat.h"
+#include "kernel/spawn.h"
+#include "kernel/cpustat.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -238,6 +241,45 @@ copyinstr3(char *s)
   }
 }
 
+// copyin() and copyout() reach user memory directly; do they
+// still refuse the pages that aren't user pages: the stack
+// guard page and the trapframe?
+void
+copyguard(char *s)
+{
+  char buf[8];
+  uint64 addrs[] = { PGROUNDDOWN((uint64)buf) - PGSIZE, MAXVA - 2*PGSIZE };
+
+  for(int ai = 0; ai < 2; ai++){
+    uint64 addr = addrs[ai];
+
+    int fd = open("README", 0);
+    if(fd < 0){
+      printf("%s: open(README) failed\n", s);
+      exit(1);
+    }
+    int n = read(fd, (void*)addr, 8);
+    if(n > 0){
+      printf("%s: read(fd, %p, 8) returned %d, not -1 or 0\n", s, addr, n);
+      exit(1);
+    }
+    close(fd);
+
+    fd = open("copyguard", O_CREATE|O_WRONLY);
+    if(fd < 0){
+      printf("%s: open(copyguard) failed\n", s);
+      exit(1);
+    }
+    n = write(fd, (void*)addr, 8);
+    if(n > 0){
+      printf("%s: write(fd, %p, 8) returned %d, not -1 or 0\n", s, addr, n);
+      exit(1);
+    }
+    close(fd);
+    unlink("copyguard");
+  }
+}
+
 // See if the kernel refuses to read/write user memory that the
 // application doesn't have anymore, because it returned it.
 void
@@ -730,6 +772,70 @@ exectest(char *s)
 
 }
 
+// spawn() with its output redirected to a pipe, and
+// spawn()s that must fail.
+void
+spawntest(char *s)
+{
+  int fds[2], pid, xstatus, n, cc;
+  char *echoargv[] = { "echo", "OK", 0 };
+  char buf[16];
+  struct spawnfd fa[] = {
+    { SPAWN_DUP, 1, 0 },
+    { SPAWN_CLOSE, 0, 0 },
+    { SPAWN_CLOSE, 0, 0 },
+    { SPAWN_END, 0, 0 },
+  };
+  struct spawnfd bad[] = {
+    { SPAWN_CLOSE, NOFILE, 0 },
+    { SPAWN_END, 0, 0 },
+  };
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  fa[0].fd2 = fds[1];
+  fa[1].fd = fds[0];
+  fa[2].fd = fds[1];
+  pid = spawn("echo", echoargv, fa);
+  if(pid < 0){
+    printf("%s: spawn echo failed\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  // echo may write "OK" and "\n" separately.
+  n = 0;
+  while((cc = read(fds[0], buf + n, sizeof(buf) - n)) > 0)
+    n += cc;
+  close(fds[0]);
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: wait failed\n", s);
+    exit(1);
+  }
+  if(n != 3 || buf[0] != 'O' || buf[1] != 'K' || buf[2] != '\n'){
+    printf("%s: wrong output\n", s);
+    exit(1);
+  }
+
+  if(spawn("nosuchprogram", echoargv, 0) >= 0){
+    printf("%s: spawned a missing program\n", s);
+    exit(1);
+  }
+  if(spawn("echo", echoargv, bad) >= 0){
+    printf("%s: spawned with a bad action\n", s);
+    exit(1);
+  }
+  if(spawn("echo", echoargv, (struct spawnfd*)0xffffffffffL) >= 0){
+    printf("%s: spawned with bad actions\n", s);
+    exit(1);
+  }
+  if(wait(0) != -1){
+    printf("%s: a failed spawn left a child\n", s);
+    exit(1);
+  }
+}
+
 // simple fork and pipe read/write
 
 void
@@ -1993,6 +2099,723 @@ forktest(char *s)
   }
 }
 
+// fork a process that uses most of the free memory.
+// only works if fork shares pages copy-on-write.
+void
+cowfork(char *s)
+{
+  struct memstat st;
+  uint64 sz;
+  char *a, *p;
+  int ppid, pid, xstatus, fds[2];
+
+  if(memstat(&st) < 0){
+    printf("%s: memstat failed\n", s);
+    exit(1);
+  }
+  sz = PGROUNDDOWN(st.freepages * PGSIZE / 3 * 2);
+  a = sbrk(sz);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  ppid = getpid();
+  for(p = a; p < a + sz; p += PGSIZE)
+    *(int*)p = ppid;
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(p = a; p < a + sz; p += PGSIZE){
+      if(*(int*)p != ppid){
+        printf("%s: child sees wrong value\n", s);
+        exit(1);
+      }
+    }
+    // write some pages, both directly and with read().
+    for(p = a; p < a + sz; p += 64*PGSIZE)
+      *(int*)p = getpid();
+    if(write(fds[1], "x", 1) != 1 || read(fds[0], a + PGSIZE, 1) != 1){
+      printf("%s: pipe i/o failed\n", s);
+      exit(1);
+    }
+    if(*(a + PGSIZE) != 'x'){
+      printf("%s: read into shared page failed\n", s);
+      exit(1);
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+
+  for(p = a; p < a + sz; p += PGSIZE){
+    if(*(int*)p != ppid){
+      printf("%s: child's write visible to parent\n", s);
+      exit(1);
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// fork shares page-table pages between parent and child;
+// each must still see only its own writes, also after
+// forking again, and after shrinking and regrowing the heap.
+void
+forkshare(char *s)
+{
+  enum { SZ = 8*1024*1024 };
+  char *a, *p;
+  int pid, xstatus, fds[2];
+
+  a = sbrk(SZ);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(p = a; p < a + SZ; p += PGSIZE)
+    *(int*)p = 1;
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(p = a; p < a + SZ; p += 16*PGSIZE)
+      *(int*)p = 2;
+    // the kernel writes into a shared page-table page's range.
+    if(write(fds[1], "x", 1) != 1 || read(fds[0], a + SZ - PGSIZE, 1) != 1 ||
+       a[SZ - PGSIZE] != 'x'){
+      printf("%s: read into shared range failed\n", s);
+      exit(1);
+    }
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      if(*(int*)a != 2 || *(int*)(a + PGSIZE) != 1){
+        printf("%s: grandchild sees wrong value\n", s);
+        exit(1);
+      }
+      if(sbrk(-SZ/2) == (char*)0xffffffffffffffffL ||
+         sbrk(SZ/2) == (char*)0xffffffffffffffffL){
+        printf("%s: sbrk failed\n", s);
+        exit(1);
+      }
+      for(p = a + SZ/2; p < a + SZ; p += PGSIZE){
+        if(*(int*)p != 0){
+          printf("%s: regrown heap not zero\n", s);
+          exit(1);
+        }
+      }
+      exit(0);
+    }
+    wait(&xstatus);
+    if(*(int*)(a + SZ/2) != 2){
+      printf("%s: grandchild's sbrk visible to child\n", s);
+      exit(1);
+    }
+    exit(xstatus);
+  }
+
+  for(p = a; p < a + SZ; p += 8*PGSIZE)
+    *(int*)p = 3;
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  for(p = a; p < a + SZ; p += PGSIZE){
+    if(*(int*)p != ((p - a) % (8*PGSIZE) == 0 ? 3 : 1)){
+      printf("%s: child's write visible to parent\n", s);
+      exit(1);
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// newly allocated memory must be zero, even if it was
+// used and freed just before.
+void
+zeroheap(char *s)
+{
+  enum { SZ = 64*PGSIZE };
+  char *a;
+
+  for(int round = 0; round < 4; round++){
+    a = sbrk(SZ);
+    if(a == (char*)0xffffffffffffffffL){
+      printf("%s: sbrk failed\n", s);
+      exit(1);
+    }
+    for(int i = 0; i < SZ; i += sizeof(uint64)){
+      if(*(uint64*)(a + i) != 0){
+        printf("%s: byte %d of new memory not zero\n", s, i);
+        exit(1);
+      }
+    }
+    memset(a, 0xa5, SZ);
+    sbrk(-SZ);
+    sleep(1);  // let idle CPUs zero pages
+  }
+}
+
+// fill two megapage-aligned megapages of heap, check that
+// the kernel moved them into megapages, then check that
+// their contents survive copy-on-write fork and shrinking
+// the heap to part way through one of them.
+void
+hugepage(char *s)
+{
+  uint64 top, pad, mega0;
+  char *a, *p;
+  int pid, xstatus;
+  struct memstat st;
+
+  if(memstat(&st) < 0){
+    printf("%s: memstat failed\n", s);
+    exit(1);
+  }
+  mega0 = st.megapages;
+  top = (uint64)sbrk(0);
+  pad = MEGAPGSIZE - top % MEGAPGSIZE;
+  if(sbrk(pad + 2*MEGAPGSIZE) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  a = (char*)(top + pad);
+  for(p = a; p < a + 2*MEGAPGSIZE; p += PGSIZE)
+    *(uint64*)p = (uint64)p;
+  if(memstat(&st) < 0 || st.megapages - mega0 < 2){
+    printf("%s: heap not in megapages\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(p = a; p < a + 2*MEGAPGSIZE; p += PGSIZE){
+      if(*(uint64*)p != (uint64)p){
+        printf("%s: child sees wrong value\n", s);
+        exit(1);
+      }
+      *(uint64*)p = 0;
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+
+  // cut the second megapage in half.
+  if(sbrk(-(MEGAPGSIZE/2)) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk shrink failed\n", s);
+    exit(1);
+  }
+  for(p = a; p < a + 2*MEGAPGSIZE - MEGAPGSIZE/2; p += PGSIZE){
+    if(*(uint64*)p != (uint64)p){
+      printf("%s: parent sees wrong value\n", s);
+      exit(1);
+    }
+  }
+  if(sbrk(MEGAPGSIZE/2) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(p = a + 2*MEGAPGSIZE - MEGAPGSIZE/2; p < a + 2*MEGAPGSIZE; p += PGSIZE){
+    if(*(uint64*)p != 0){
+      printf("%s: regrown heap not zeroed\n", s);
+      exit(1);
+    }
+  }
+  sbrk(-(pad + 2*MEGAPGSIZE));
+}
+
+// pages of a program's data that it has not yet touched are
+// read in by the kernel's copyin(), which may sleep; check that
+// a pipe write() from one works.
+static const char pagedata[3*PGSIZE] = { [PGSIZE] = 'p', [2*PGSIZE-1] = 'q' };
+
+void
+pagepipe(char *s)
+{
+  int fds[2];
+  char b[8];
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(write(fds[1], &pagedata[PGSIZE], 1) != 1 ||
+     write(fds[1], &pagedata[2*PGSIZE-1], 1) != 1){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if(read(fds[0], b, 2) != 2 || b[0] != 'p' || b[1] != 'q'){
+    printf("%s: read wrong data\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// map a file both shared and private, and check that
+// the mappings, read(), write(), fork() and munmap() agree.
+void
+mmaptest(char *s)
+{
+  enum { SZ = 2*PGSIZE + 100 };
+  char *sh, *pr;
+  int fd, fd2, i, pid, xstatus;
+  struct stat st;
+
+  unlink("mmap.tmp");
+  fd = open("mmap.tmp", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++)
+    buf[i] = 'a' + i % 23;
+  if(write(fd, buf, SZ) != SZ){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+
+  sh = mmap(0, 3*PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  pr = mmap(0, 3*PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(sh == (char*)-1 || pr == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 3*PGSIZE; i++){
+    char c = i < SZ ? 'a' + i % 23 : 0;
+    if(sh[i] != c || pr[i] != c){
+      printf("%s: mapped byte %d wrong\n", s, i);
+      exit(1);
+    }
+  }
+
+  // a private write is invisible to the shared mapping.
+  pr[0] = 'X';
+  if(sh[0] != 'a'){
+    printf("%s: private write visible\n", s);
+    exit(1);
+  }
+
+  // write() is visible through the shared mapping.
+  fd2 = open("mmap.tmp", O_RDWR);
+  if(fd2 < 0 || write(fd2, "ZZ", 2) != 2){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  close(fd2);
+  if(sh[0] != 'Z' || sh[1] != 'Z'){
+    printf("%s: write() not visible in mapping\n", s);
+    exit(1);
+  }
+
+  // a child shares the shared mapping, but not the private one.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    sh[PGSIZE+1] = 'C';
+    pr[PGSIZE+1] = 'P';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  if(sh[PGSIZE+1] != 'C' || pr[PGSIZE+1] == 'P'){
+    printf("%s: child's writes seen wrongly\n", s);
+    exit(1);
+  }
+
+  // the mapping is newer than the disk; read() must see it.
+  sh[2] = 'R';
+  fd2 = open("mmap.tmp", O_RDONLY);
+  if(fd2 < 0 || read(fd2, buf, 3) != 3 || buf[2] != 'R'){
+    printf("%s: read() doesn't see mapping\n", s);
+    exit(1);
+  }
+  close(fd2);
+
+  // punch a hole, then unmap the rest.
+  if(munmap(sh + PGSIZE, PGSIZE) != 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  if(sh[0] != 'Z' || sh[2*PGSIZE] != 'a' + (2*PGSIZE) % 23){
+    printf("%s: mapping changed by munmap\n", s);
+    exit(1);
+  }
+  if(munmap(sh, PGSIZE) != 0 || munmap(sh + 2*PGSIZE, PGSIZE) != 0 ||
+     munmap(pr, 3*PGSIZE) != 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // writes through the shared mapping reached the file,
+  // which didn't grow.
+  fd = open("mmap.tmp", O_RDONLY);
+  if(fd < 0 || fstat(fd, &st) < 0 || st.size != SZ ||
+     read(fd, buf, SZ) != SZ){
+    printf("%s: reopen failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(buf[0] != 'Z' || buf[1] != 'Z' || buf[2] != 'R' || buf[PGSIZE+1] != 'C'){
+    printf("%s: mapped writes lost\n", s);
+    exit(1);
+  }
+  unlink("mmap.tmp");
+}
+
+// many small mappings, with holes between them, spread
+// over the address space far above the heap: fork() and
+// exit() must copy and free only what is mapped, and
+// the child's writes stay private.
+void
+sparsemap(char *s)
+{
+  enum { N = 40 };
+  char *m[N];
+  int fd, i, pid, xstatus;
+
+  unlink("sparse.tmp");
+  fd = open("sparse.tmp", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "sparse", 6) != 6){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    m[i] = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if(m[i] == (char*)-1){
+      printf("%s: mmap %d failed\n", s, i);
+      exit(1);
+    }
+    m[i][100] = i;
+  }
+  close(fd);
+  unlink("sparse.tmp");
+  for(i = 0; i < N; i += 2){
+    if(munmap(m[i], PGSIZE) != 0){
+      printf("%s: munmap failed\n", s);
+      exit(1);
+    }
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 1; i < N; i += 2){
+      if(m[i][0] != 's' || m[i][100] != i)
+        exit(1);
+      m[i][100] = -1;
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong contents\n", s);
+    exit(1);
+  }
+  for(i = 1; i < N; i += 2){
+    if(m[i][100] != i){
+      printf("%s: child's write seen\n", s);
+      exit(1);
+    }
+  }
+  for(i = 1; i < N; i += 2)
+    munmap(m[i], PGSIZE);
+}
+
+// exec() with argv, and its strings, in a mapped region
+// above the heap.
+void
+mmapargv(char *s)
+{
+  char **av, *m;
+  int fd, pid, xstatus;
+  char buf[3];
+
+  unlink("mmapargv.tmp");
+  unlink("mmapargv.out");
+  fd = open("mmapargv.tmp", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "x", 1) != 1){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  m = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  unlink("mmapargv.tmp");
+  if(m == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  av = (char**)m;
+  strcpy(m + 64, "echo");
+  strcpy(m + 72, "OK");
+  av[0] = m + 64;
+  av[1] = m + 72;
+  av[2] = 0;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(1);
+    if(open("mmapargv.out", O_CREATE|O_WRONLY) != 1)
+      exit(1);
+    exec("echo", av);
+    exit(1);
+  }
+  wait(&xstatus);
+  fd = open("mmapargv.out", O_RDONLY);
+  if(xstatus != 0 || fd < 0 || read(fd, buf, 2) != 2 ||
+     buf[0] != 'O' || buf[1] != 'K'){
+    printf("%s: exec with mapped argv failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("mmapargv.out");
+  munmap(m, PGSIZE);
+}
+
+// setpriority() returns the old base level, rejects levels
+// out of range, and fork() passes the level on.
+void
+setprio(char *s)
+{
+  int pid, xstatus;
+
+  if(setpriority(0, 2) != 0 || setpriority(0, 1) != 2){
+    printf("%s: wrong old level\n", s);
+    exit(1);
+  }
+  if(setpriority(0, -1) != -1 || setpriority(0, NPRIO) != -1){
+    printf("%s: bad level accepted\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(setpriority(0, 0) == 1 ? 0 : 1);
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child didn't inherit level\n", s);
+    exit(1);
+  }
+  if(setpriority(pid, 0) != -1){
+    printf("%s: set level of dead process\n", s);
+    exit(1);
+  }
+  setpriority(0, 0);
+}
+
+// while every process sleeps, the CPUs wait in wfi, and
+// cpustat() counts the time.
+void
+cpuidle(char *s)
+{
+  struct cpustat a[NCPU], b[NCPU];
+  uint64 idle = 0;
+  int n;
+
+  n = cpustat(a);
+  if(n < 1 || n > NCPU){
+    printf("%s: cpustat returned %d\n", s, n);
+    exit(1);
+  }
+  sleep(5);
+  if(cpustat(b) != n){
+    printf("%s: number of CPUs changed\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < NCPU; i++){
+    if((a[i].started == 0) != (b[i].started == 0)){
+      printf("%s: cpu %d started or stopped\n", s, i);
+      exit(1);
+    }
+    idle += b[i].idletime - a[i].idletime;
+  }
+  if(idle == 0){
+    printf("%s: no CPU was idle\n", s);
+    exit(1);
+  }
+}
+
+// nanosleep() sleeps at least as long as asked, but wakes up
+// between clock ticks rather than at the next one; sleep()
+// sleeps whole ticks.
+void
+nanosleeptest(char *s)
+{
+  uint64 t0, t;
+
+  t0 = r_time();
+  if(nanosleep(500000) != 0 || r_time() - t0 < TIMEBASE / 2000){
+    printf("%s: woke too soon\n", s);
+    exit(1);
+  }
+  t0 = r_time();
+  for(int i = 0; i < 20; i++)
+    nanosleep(500000);
+  t = r_time() - t0;
+  if(t >= 5*TICKCYCLES){
+    printf("%s: 20 sleeps of 0.5 ms took %d ms\n", s,
+           (int)(t / (TIMEBASE / 1000)));
+    exit(1);
+  }
+  t0 = r_time();
+  sleep(2);
+  if(r_time() - t0 < 2*TICKCYCLES){
+    printf("%s: sleep(2) woke too soon\n", s);
+    exit(1);
+  }
+}
+
+// use more memory than is free, so that some of it is
+// paged out, and check that it all comes back, in the
+// process and in a child that shares it after fork.
+// the pages are mostly zeros, so they compress well
+// even if there's no swap disk.
+void
+swaptest(char *s)
+{
+  struct memstat st;
+  uint64 *a, n, i;
+  int pid, xstatus;
+
+  if(memstat(&st) < 0){
+    printf("%s: memstat failed\n", s);
+    exit(1);
+  }
+  n = st.freepages + 4096;
+  a = (uint64*)sbrk(n * PGSIZE);
+  if(a == (uint64*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < n; i++)
+    a[i * PGSIZE/sizeof(uint64)] = i;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < n; i++){
+    if(a[i * PGSIZE/sizeof(uint64)] != i){
+      printf("%s: page %d lost\n", s, (int)i);
+      exit(1);
+    }
+  }
+  if(pid == 0)
+    exit(0);
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+
+  if(memstat(&st) < 0 || st.swapouts == 0 || st.swapins == 0){
+    printf("%s: nothing was swapped\n", s);
+    exit(1);
+  }
+}
+
+// children that fill memory with the same data should
+// end up sharing it, and get their own copies back when
+// they write.
+void
+ksmtest(char *s)
+{
+  enum { NCHILD = 4, NPAGE = 16, NWORD = PGSIZE/sizeof(uint64) };
+  struct memstat st;
+  uint64 *a, merged0, i;
+  int c, pid, xstatus, old, t0;
+
+  if(memstat(&st) < 0){
+    printf("%s: memstat failed\n", s);
+    exit(1);
+  }
+  merged0 = st.ksmmerged;
+  old = ksm(1000);
+
+  for(c = 0; c < NCHILD; c++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      ksm(old);
+      exit(1);
+    }
+    if(pid == 0){
+      a = (uint64*)sbrk(NPAGE * PGSIZE);
+      if(a == (uint64*)0xffffffffffffffffL){
+        printf("%s: sbrk failed\n", s);
+        exit(1);
+      }
+      for(i = 0; i < NPAGE * NWORD; i++)
+        a[i] = i / NWORD + 1000;
+      // stay idle while the scanner finds the pages.
+      t0 = uptime();
+      do {
+        sleep(1);
+        memstat(&st);
+      } while(st.ksmmerged - merged0 < (NCHILD-1) * NPAGE && uptime() - t0 < 100);
+      a[0] = 7;
+      for(i = 0; i < NPAGE * NWORD; i++){
+        if(a[i] != (i == 0 ? 7 : i / NWORD + 1000)){
+          printf("%s: word %d changed\n", s, (int)i);
+          exit(1);
+        }
+      }
+      exit(0);
+    }
+  }
+  for(c = 0; c < NCHILD; c++){
+    wait(&xstatus);
+    if(xstatus != 0){
+      ksm(old);
+      exit(xstatus);
+    }
+  }
+  ksm(old);
+
+  if(memstat(&st) < 0 || st.ksmmerged - merged0 < (NCHILD-1) * NPAGE){
+    printf("%s: only %d pages merged\n", s, (int)(st.ksmmerged - merged0));
+    exit(1);
+  }
+}
+
 void
 sbrkbasic(char *s)
 {
@@ -2580,6 +3403,7 @@ struct test {
   {copyinstr1, "copyinstr1"},
   {copyinstr2, "copyinstr2"},
   {copyinstr3, "copyinstr3"},
+  {copyguard, "copyguard"},
   {rwsbrk, "rwsbrk" },
   {truncate1, "truncate1"},
   {truncate2, "truncate2"},
@@ -2593,6 +3417,7 @@ struct test {
   {createtest, "createtest"},
   {dirtest, "dirtest"},
   {exectest, "exectest"},
+  {spawntest, "spawntest"},
   {pipe1, "pipe1"},
   {killstatus, "killstatus"},
   {preempt, "preempt"},
@@ -2618,6 +3443,19 @@ struct test {
   {dirfile, "dirfile"},
   {iref, "iref"},
   {forktest, "forktest"},
+  {cowfork, "cowfork"},
+  {forkshare, "forkshare"},
+  {zeroheap, "zeroheap"},
+  {hugepage, "hugepage"},
+  {mmaptest, "mmaptest"},
+  {pagepipe, "pagepipe"},
+  {sparsemap, "sparsemap"},
+  {mmapargv, "mmapargv"},
+  {setprio, "setprio"},
+  {cpuidle, "cpuidle"},
+  {nanosleeptest, "nanosleeptest"},
+  {swaptest, "swaptest"},
+  {ksmtest, "ksmtest"},
   {sbrkbasic, "sbrkbasic"},
   {sbrkmuch, "sbrkmuch"},
   {kernmem, "kernmem"},
@@ -2924,6 +3762,73 @@ outofinodes(char *s)
   }
 }
 
+// in a kernel with the fair-share scheduler, processes that
+// all want the CPU get it in proportion to their weights:
+// NCPU processes of weight 3*DEFWEIGHT and NCPU of weight
+// DEFWEIGHT, more than there can be CPUs, spin for the same
+// few seconds, and the heavy ones should get about three
+// times the CPU time of the light ones.
+void
+fairshare(char *s)
+{
+  enum { N = 2*NCPU, TIME = 30000000 };  // time CSR cycles: 3 seconds
+  int start[2], done[2], i, pid;
+  uint64 end, r[2], light = 0, heavy = 0;
+
+  if(setweight(0, DEFWEIGHT) < 0)
+    return;  // not built with make SCHED=cfs
+  if(pipe(start) < 0 || pipe(done) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      volatile int x = 0;
+      uint64 n = 0;
+
+      if(setweight(0, i % 2 ? 3*DEFWEIGHT : DEFWEIGHT) < 0 ||
+         read(start[0], &end, sizeof(end)) != sizeof(end))
+        exit(1);
+      while(r_time() < end){
+        for(int k = 0; k < 1000; k++)
+          x++;
+        n++;
+      }
+      r[0] = i;
+      r[1] = n;
+      write(done[1], r, sizeof(r));
+      exit(0);
+    }
+  }
+
+  // start them all at once, so they compete for the whole time.
+  end = r_time() + TIME;
+  for(i = 0; i < N; i++)
+    write(start[1], &end, sizeof(end));
+  for(i = 0; i < N; i++){
+    if(read(done[0], r, sizeof(r)) != sizeof(r)){
+      printf("%s: child failed\n", s);
+      exit(1);
+    }
+    if(r[0] % 2)
+      heavy += r[1];
+    else
+      light += r[1];
+  }
+  for(i = 0; i < N; i++)
+    wait(0);
+  if(heavy < 2*light || heavy > 4*light){
+    printf("%s: heavy got %d, light %d, not about 3:1\n", s,
+           (int)heavy, (int)light);
+    exit(1);
+  }
+}
+
 struct test slowtests[] = {
   {bigdir, "bigdir"},
   {manywrites, "manywrites"},
@@ -2931,6 +3836,7 @@ struct test slowtests[] = {
   {execout, "execout"},
   {diskfull, "diskfull"},
   {outofinodes, "outofinodes"},
+  {fairshare, "fairshare"},
     
   { 0, 0},
 };
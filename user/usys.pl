@@ -36,3 +36,12 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("memstat");
+entry("mmap");
+entry("munmap");
+entry("ksm");
+entry("spawn");
+entry("setpriority");
+entry("setweight");
+entry("cpustat");
+entry("nanosleep");